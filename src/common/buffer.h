@@ -10,7 +10,8 @@ namespace rendertoy {
 
 enum class Buffers {
     kColor = 1,
-    kDepth = 2
+    kDepth = 2,
+    kId = 4
 };
 
 inline Buffers operator|(Buffers a, Buffers b) {
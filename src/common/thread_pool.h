@@ -0,0 +1,110 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+#include "common/uncopyable.h"
+
+namespace rendertoy {
+
+// Fixed size worker pool. The calling thread takes part in ParallelFor, so a pool
+// of size 1 has no worker threads and simply runs the jobs inline.
+class ThreadPool : private Uncopyable {
+public:
+    explicit ThreadPool(int thread_count = 0) : generation_(0), job_count_(0), busy_(0), quit_(false) {
+        if (thread_count <= 0) {
+            thread_count = std::thread::hardware_concurrency();
+        }
+        if (thread_count <= 0) {
+            thread_count = 1;
+        }
+
+        for (int i = 1; i < thread_count; ++i) {
+            workers_.emplace_back([this]() { WorkerLoop(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            quit_ = true;
+        }
+        wake_.notify_all();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    int size() const { return (int)workers_.size() + 1; }
+
+    // Runs func(i) for every i in [0, count) and returns when all of them are done.
+    void ParallelFor(int count, const std::function<void(int)>& func) {
+        if (count <= 0) return;
+        if (workers_.empty() || count == 1) {
+            for (int i = 0; i < count; ++i) {
+                func(i);
+            }
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            job_ = &func;
+            job_count_ = count;
+            next_job_ = 0;
+            busy_ = (int)workers_.size();
+            ++generation_;
+        }
+        wake_.notify_all();
+
+        RunJobs();
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this]() { return busy_ == 0; });
+        job_ = nullptr;
+    }
+
+private:
+    void RunJobs() {
+        for (int i = next_job_++; i < job_count_; i = next_job_++) {
+            (*job_)(i);
+        }
+    }
+
+    void WorkerLoop() {
+        uint64_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [this, seen]() { return quit_ || generation_ != seen; });
+                if (quit_) return;
+                seen = generation_;
+            }
+
+            RunJobs();
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (--busy_ == 0) {
+                done_.notify_one();
+            }
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+
+    const std::function<void(int)>* job_ = nullptr;
+    uint64_t generation_;
+    int job_count_;
+    std::atomic<int> next_job_{0};
+    int busy_;
+    bool quit_;
+};
+
+}
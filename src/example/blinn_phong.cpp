@@ -121,6 +121,7 @@ int main(int argc, const char** argv) {
     Pipeline pipeline;
     RenderTexture render_texture(1280, 720);
     render_texture.msaa(MSAALevel::k4x);
+    render_texture.tiled(true);
     render_texture.Clear(Buffers::kColor | Buffers::kDepth);
     pipeline.SetRenderTarget(&render_texture);
     
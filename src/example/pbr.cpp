@@ -1,5 +1,7 @@
 #include <iostream>
 #include <vector>
+#include <chrono>
+#include <cstdlib>
 #include "image.h"
 #include "math/util.h"
 #include "math/vec3.h"
@@ -38,8 +40,8 @@ void test_pbr(Pipeline& pipeline) {
 
     PbrMaterial* mat = pipeline.CreateMaterial<PbrMaterial>();
 
-    mat->f0 = { 0.04f };
-    mat->ambient_color = {0.09f};
+    mat->f0 = Vec3f(0.04f);
+    mat->ambient_color = Vec3f(0.09f);
     
     Texture2D* albedo_tex = pipeline.CreateTexture2D("../assets/helmet/helmet_albedo.png", true);
     mat->albedo_tex = albedo_tex;
@@ -94,8 +96,19 @@ int main(int argc, const char** argv) {
     set_flip_vertically_on_load(1);
     
     Pipeline pipeline;
+    //render [thread_count] [prepass] [eqaa]: use the tiled backend with the given number of threads, 0 for all cores,
+    //a non zero prepass renders depth first so every visible sample is shaded once,
+    //a non zero eqaa takes 8 coverage samples sharing 2 colors per pixel instead of 4x MSAA
+    if (argc > 1) {
+        pipeline.SetBackend(RasterBackend::kTiled, std::atoi(argv[1]));
+    }
+    if (argc > 2) {
+        pipeline.SetDepthPrepass(std::atoi(argv[2]) != 0);
+    }
+
     RenderTexture render_texture(1280, 720);
-    render_texture.msaa(MSAALevel::k4x);
+    render_texture.msaa(argc > 3 && std::atoi(argv[3]) != 0 ? MSAALevel::kEQAA8x : MSAALevel::k4x);
+    render_texture.tiled(true);
     render_texture.Clear(Buffers::kColor | Buffers::kDepth);
     pipeline.SetRenderTarget(&render_texture);
     
@@ -104,7 +117,16 @@ int main(int argc, const char** argv) {
     test_pbr(pipeline);
     
     Camera camera(40, 0.1, 50, { 0, 0, -3 }, Vec3f::zero, Vec3f::up);
+    auto start = std::chrono::steady_clock::now();
     pipeline.Render(camera, Primitive::kTriangle);
+    auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+    std::cout << "render time: " << elapsed.count() << " ms" << std::endl;
+
+    Graphics* graphic = Graphics::Instance();
+    std::cout << "blocks accepted: " << graphic->counter(RenderCounter::kBlockAccepted)
+        << ", rejected: " << graphic->counter(RenderCounter::kBlockRejected)
+        << ", partial: " << graphic->counter(RenderCounter::kBlockPartial) << std::endl;
+    std::cout << "fragments shaded: " << graphic->counter(RenderCounter::kFragmentShaded) << std::endl;
     //pipeline.Render(camera, Primitive::kLine);
 
     Buffer<Col3U8> color_buffer(render_texture.width(), render_texture.height());
@@ -38,8 +38,8 @@ void test_shadow(Pipeline& pipeline) {
 
     PbrMaterial* mat = pipeline.CreateMaterial<PbrMaterial>();
 
-    mat->f0 = { 0.04f };
-    mat->ambient_color = { 0.09f };
+    mat->f0 = Vec3f(0.04f);
+    mat->ambient_color = Vec3f(0.09f);
 
     Texture2D* albedo_tex = pipeline.CreateTexture2D("../assets/helmet/helmet_albedo.png", true);
     mat->albedo_tex = albedo_tex;
@@ -122,6 +122,7 @@ int main(int argc, const char** argv) {
     Pipeline pipeline;
     RenderTexture render_texture(1280, 720);
     render_texture.msaa(MSAALevel::k4x);
+    render_texture.tiled(true);
     render_texture.Clear(Buffers::kColor | Buffers::kDepth);
     pipeline.SetRenderTarget(&render_texture);
 
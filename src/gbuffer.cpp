@@ -0,0 +1,72 @@
+#include "gbuffer.h"
+
+namespace rendertoy {
+
+GBuffer::GBuffer(int w, int h) {
+    Resize(w, h);
+    Clear();
+}
+
+void GBuffer::Resize(int w, int h) {
+    albedo_.Resize(w * kSlots, h);
+    normal_.Resize(w * kSlots, h);
+    emission_.Resize(w * kSlots, h);
+    position_.Resize(w * kSlots, h);
+    metallic_roughness_ao_.Resize(w * kSlots, h);
+    draw_.Resize(w * kSlots, h);
+    coverage_.Resize(w, h);
+    selector_.Resize(w, h);
+}
+
+void GBuffer::Clear() {
+    coverage_.Fill(0);
+    draws_.clear();
+    draws_.push_back({ nullptr, nullptr }); //id 0 is no draw
+}
+
+uint32_t GBuffer::AddDraw(const Shader* shader, const Material* material) {
+    draws_.push_back({ shader, material });
+    return (uint32_t)draws_.size() - 1;
+}
+
+bool GBuffer::HasRoom(int x, int y, int sample_mask) const {
+    int kept = coverage_.Get(x, y) & ~sample_mask;
+    int selector = selector_.Get(x, y);
+    return (kept & ~selector) == 0 || (kept & selector) == 0;
+}
+
+void GBuffer::SetSurface(int x, int y, const SurfaceData& surface, uint32_t draw, int sample_mask) {
+    assert(HasRoom(x, y, sample_mask));
+    //the slot the samples outside the mask do not use
+    int coverage = coverage_.Get(x, y);
+    int selector = selector_.Get(x, y);
+    int slot = (coverage & ~sample_mask & ~selector) == 0 ? 0 : 1;
+
+    int sx = x * kSlots + slot;
+    albedo_.Set(sx, y, surface.albedo);
+    normal_.Set(sx, y, surface.normal);
+    emission_.Set(sx, y, surface.emission);
+    position_.Set(sx, y, surface.world_position);
+    metallic_roughness_ao_.Set(sx, y, { surface.metallic, surface.roughness, surface.ao });
+    draw_.Set(sx, y, draw);
+    coverage_.Set(x, y, coverage | sample_mask);
+    selector_.Set(x, y, slot ? (selector | sample_mask) : (selector & ~sample_mask));
+}
+
+void GBuffer::ClearSamples(int x, int y, int sample_mask) {
+    coverage_.Set(x, y, coverage_.Get(x, y) & ~sample_mask);
+}
+
+void GBuffer::GetSurface(int x, int y, int slot, SurfaceData& surface) const {
+    int sx = x * kSlots + slot;
+    surface.albedo = albedo_.Get(sx, y);
+    surface.normal = normal_.Get(sx, y);
+    surface.emission = emission_.Get(sx, y);
+    surface.world_position = position_.Get(sx, y);
+    Vec3f mra = metallic_roughness_ao_.Get(sx, y);
+    surface.metallic = mra.x;
+    surface.roughness = mra.y;
+    surface.ao = mra.z;
+}
+
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <assert.h>
+#include "math/vec3.h"
+#include "common/uncopyable.h"
+#include "common/buffer.h"
+
+namespace rendertoy {
+
+class Shader;
+class Material;
+
+//material properties of a fragment, everything the lighting of a deferred shader needs
+struct SurfaceData {
+    Vec3f albedo;
+    Vec3f normal;
+    Vec3f emission;
+    Vec3f world_position;
+    Vec3f shadow_coord;
+    float metallic;
+    float roughness;
+    float ao;
+};
+
+//multi-target geometry buffer for deferred shading. under MSAA a pixel keeps up to kSlots surfaces
+//and the slot of every sample, like the compressed colors of RenderTexture
+class GBuffer : private Uncopyable {
+public:
+    static constexpr int kSlots = 2;
+
+    //the shader and material a surface was written with, the lighting pass runs the same shader
+    struct Draw {
+        const Shader* shader;
+        const Material* material;
+    };
+
+    GBuffer() {}
+    GBuffer(int w, int h);
+
+    int width() const { return coverage_.width(); }
+    int height() const { return coverage_.height(); }
+
+    void Resize(int w, int h);
+    //drop all surfaces and draws
+    void Clear();
+
+    //returns the id of a new draw, ids are never 0
+    uint32_t AddDraw(const Shader* shader, const Material* material);
+    const Draw& draw(uint32_t id) const { return draws_[id]; }
+
+    //false if the samples left outside sample_mask already use every slot, such fragments are shaded forward
+    bool HasRoom(int x, int y, int sample_mask) const;
+    //the surface of the samples in sample_mask, there has to be room for it
+    void SetSurface(int x, int y, const SurfaceData& surface, uint32_t draw, int sample_mask);
+    //samples overwritten by forward shading are not lit again
+    void ClearSamples(int x, int y, int sample_mask);
+
+    //shadow_coord is not stored, it is derived from the world position by the lighting pass
+    void GetSurface(int x, int y, int slot, SurfaceData& surface) const;
+    uint32_t GetDraw(int x, int y, int slot) const { return draw_.Get(x * kSlots + slot, y); }
+    //samples lit with the surface in slot
+    int GetCoverage(int x, int y, int slot) const {
+        int selector = selector_.Get(x, y);
+        return coverage_.Get(x, y) & (slot ? selector : ~selector);
+    }
+
+private:
+    Buffer<Vec3f> albedo_;
+    Buffer<Vec3f> normal_;
+    Buffer<Vec3f> emission_;
+    Buffer<Vec3f> position_;
+    Buffer<Vec3f> metallic_roughness_ao_;
+    Buffer<uint32_t> draw_;
+    Buffer<uint8_t> coverage_; //samples of the render target a surface is lit for
+    Buffer<uint8_t> selector_; //bit i is the slot of sample i
+
+    std::vector<Draw> draws_;
+};
+
+}
@@ -14,22 +14,289 @@ Graphics::Graphics() :
     far_(50.0f),
     write_depth_(true),
     cull_(CullMode::kBack),
+    depth_func_(DepthFunc::kLess),
     shader_(nullptr),
+    gbuffer_(nullptr),
+    gbuffer_draw_(0),
+    visibility_(false),
+    visibility_draw_(-1),
+    varyings_(Varyings::kAll),
     render_texture_(nullptr),
-    render_type_(Primitive::kLine) 
+    render_type_(Primitive::kLine),
+    backend_(RasterBackend::kImmediate),
+    tile_cols_(0),
+    tile_rows_(0)
 {
+    ResetCounters();
+    SelectKernels();
+}
 
+void Graphics::ResetCounters() {
+    for (auto& c : counters_) {
+        c.store(0, std::memory_order_relaxed);
+    }
 }
 
 void Graphics::SetRenderTarget(RenderTexture* rt) {
+    Flush();
     render_texture_ = rt;
+
+    if (render_texture_) {
+        tile_cols_ = (render_texture_->width() + kTileSize - 1) / kTileSize;
+        tile_rows_ = (render_texture_->height() + kTileSize - 1) / kTileSize;
+        tile_bins_.resize(tile_cols_ * tile_rows_);
+    }
+    SelectKernels();
+}
+
+void Graphics::SetBackend(RasterBackend backend, int thread_count) {
+    Flush();
+    backend_ = backend;
+
+    if (backend_ == RasterBackend::kTiled) {
+        if (!thread_pool_ || thread_count <= 0 || thread_pool_->size() != thread_count) {
+            thread_pool_.reset();
+            thread_pool_ = std::make_unique<ThreadPool>(thread_count);
+        }
+    } else {
+        thread_pool_.reset();
+    }
 }
 
-void Graphics::SetShader(const Shader* shader) {
+void Graphics::SetShader(Shader* shader) {
+    Flush();
     shader_ = shader;
-    SetWriteDepth(shader_->write_depth());
+    //an equal test only passes where the depth is already stored, writing it again is wasted work
+    SetWriteDepth(shader_->write_depth() && depth_func_ != DepthFunc::kEqual);
     SetWriteColor(shader_->write_color());
     SetCullMode(shader_->cull());
+    AddDraw();
+}
+
+void Graphics::AddDraw() {
+    gbuffer_draw_ = 0;
+    visibility_draw_ = -1;
+    if (!shader_) return;
+
+    if (gbuffer_ && shader_->deferred()) {
+        gbuffer_draw_ = gbuffer_->AddDraw(shader_, shader_->uniform()->mat);
+    }
+
+    //the visibility buffer is shaded after all draws, so every draw keeps its own copy of the uniform
+    if (visibility_ && shader_->write_color()) {
+        const Uniform* u = shader_->uniform();
+        int shadow_light = -1;
+        if (u->shadow_light_ && u->shadow_light_ >= u->lights.data() && u->shadow_light_ < u->lights.data() + u->lights.size()) {
+            shadow_light = (int)(u->shadow_light_ - u->lights.data());
+        }
+        visibility_draws_.push_back({ shader_, *u, shadow_light });
+        visibility_draw_ = (int)visibility_draws_.size() - 1;
+    }
+}
+
+void Graphics::SetGBuffer(GBuffer* gbuffer) {
+    Flush();
+    gbuffer_ = gbuffer;
+    AddDraw();
+}
+
+void Graphics::BeginVisibilityBuffer() {
+    Flush();
+    visibility_ = true;
+    visibility_triangles_.clear();
+    visibility_draws_.clear();
+    render_texture_->Clear(Buffers::kId);
+    AddDraw();
+}
+
+void Graphics::ResolveVisibilityBuffer() {
+    Flush();
+    visibility_ = false;
+    AddDraw();
+
+    //bin the 2x2 quads by draw, so every draw is shaded with its own uniform
+    int width = render_texture_->width();
+    int height = render_texture_->height();
+    int samples = render_texture_->sample_size();
+    std::vector<std::vector<uint32_t>> draw_quads(visibility_draws_.size());
+    for (int y = 0; y < height; y += 2) {
+        for (int x = 0; x < width; x += 2) {
+            int draws[4 * RenderTexture::kMaxSampleSize];
+            int count = 0;
+            for (int lane = 0; lane < 4; ++lane) {
+                int px = x + (lane & 1);
+                int py = y + (lane >> 1);
+                if (px >= width || py >= height) continue;
+
+                for (int i = 0; i < samples; ++i) {
+                    uint32_t id = render_texture_->GetId(px, py, i);
+                    if (id == 0) continue;
+
+                    int draw = visibility_triangles_[id - 1].draw;
+                    if (std::find(draws, draws + count, draw) == draws + count) {
+                        draws[count++] = draw;
+                        draw_quads[draw].push_back(((uint32_t)y << 16) | (uint32_t)x);
+                    }
+                }
+            }
+        }
+    }
+
+    static constexpr int kQuadsPerJob = 64;
+    for (size_t draw = 0; draw < visibility_draws_.size(); ++draw) {
+        auto& quads = draw_quads[draw];
+        if (quads.empty()) continue;
+
+        VisibilityDraw& d = visibility_draws_[draw];
+        if (d.shadow_light >= 0) {
+            //shaders find the shadow casting light by address
+            d.uniform.shadow_light_ = &d.uniform.lights[d.shadow_light];
+        }
+        d.shader->uniform(&d.uniform);
+
+        int jobs = ((int)quads.size() + kQuadsPerJob - 1) / kQuadsPerJob;
+        auto shade_quads = [this, &quads, draw](int job) {
+            std::optional<ScreenTriangle> tri; //neighbouring quads mostly see the same triangle
+            size_t end = math::Min(quads.size(), (size_t)(job + 1) * kQuadsPerJob);
+            for (size_t i = (size_t)job * kQuadsPerJob; i < end; ++i) {
+                ShadeVisibilityQuad((uint32_t)draw, quads[i] & 0xFFFF, quads[i] >> 16, tri);
+            }
+        };
+        if (thread_pool_) {
+            thread_pool_->ParallelFor(jobs, shade_quads);
+        } else {
+            for (int job = 0; job < jobs; ++job) {
+                shade_quads(job);
+            }
+        }
+    }
+}
+
+void Graphics::ShadeVisibilityQuad(uint32_t draw, int x, int y, std::optional<ScreenTriangle>& tri) {
+    int width = render_texture_->width();
+    int height = render_texture_->height();
+    int samples = render_texture_->sample_size();
+
+    //sample masks of every triangle of the draw in the quad, usually there is only one
+    uint32_t ids[4 * RenderTexture::kMaxSampleSize];
+    int masks[4 * RenderTexture::kMaxSampleSize][4] = {};
+    int count = 0;
+    for (int lane = 0; lane < 4; ++lane) {
+        int px = x + (lane & 1);
+        int py = y + (lane >> 1);
+        if (px >= width || py >= height) continue;
+
+        for (int i = 0; i < samples; ++i) {
+            uint32_t id = render_texture_->GetId(px, py, i);
+            if (id == 0 || visibility_triangles_[id - 1].draw != draw) continue;
+
+            int n = (int)(std::find(ids, ids + count, id) - ids);
+            if (n == count) {
+                ids[count++] = id;
+            }
+            masks[n][lane] |= 1 << i;
+        }
+    }
+
+    //interpolated the same way as the forward path, quads are aligned to even pixels there as well
+    const Shader* shader = visibility_draws_[draw].shader;
+    Varyings shader_varyings = shader->varyings();
+    for (int n = 0; n < count; ++n) {
+        if (!tri || tri->id != ids[n]) {
+            const VisibilityTriangle& t = visibility_triangles_[ids[n] - 1];
+            tri.emplace(t.v0, t.v1, t.v2, render_texture_, shader_varyings);
+            tri->id = ids[n];
+        }
+
+        VertexOut quad[4];
+        tri->RasterizeQuad(x, y, quad);
+        FragmentBatch batch;
+        int lanes[4];
+        for (int lane = 0; lane < 4; ++lane) {
+            if (masks[n][lane] == 0) continue;
+            lanes[batch.size] = lane;
+            batch.fragments[batch.size++] = &quad[lane];
+        }
+
+        Vec4f colors[4];
+        shader->FragBatch(batch, colors);
+        Count(RenderCounter::kFragmentShaded, batch.size);
+        for (int k = 0; k < batch.size; ++k) {
+            int lane = lanes[k];
+            render_texture_->SetColorSamples(x + (lane & 1), y + (lane >> 1), colors[k], masks[n][lane]);
+        }
+    }
+}
+
+void Graphics::DrawGBuffer(const GBuffer& gbuffer) {
+    Flush();
+    assert(render_texture_);
+    assert(gbuffer.width() == render_texture_->width() && gbuffer.height() == render_texture_->height());
+
+    auto light_row = [this, &gbuffer](int y) {
+        //runs of surfaces of the same draw are lit with one LightingBatch call
+        SurfaceData surfaces[FragmentBatch::kMaxSize];
+        int pixels[FragmentBatch::kMaxSize];
+        int coverages[FragmentBatch::kMaxSize];
+        uint32_t batch_draw = 0;
+        int count = 0;
+        uint64_t lit = 0;
+        auto light_batch = [&]() {
+            if (count == 0) return;
+            const GBuffer::Draw& draw = gbuffer.draw(batch_draw);
+            Vec4f colors[FragmentBatch::kMaxSize];
+            draw.shader->LightingBatch(surfaces, count, draw.material, colors);
+            for (int i = 0; i < count; ++i) {
+                render_texture_->SetColorSamples(pixels[i], y, colors[i], coverages[i]);
+            }
+            lit += count;
+            count = 0;
+        };
+
+        for (int x = 0; x < gbuffer.width(); ++x) {
+            for (int slot = 0; slot < GBuffer::kSlots; ++slot) {
+                int coverage = gbuffer.GetCoverage(x, y, slot);
+                if (coverage == 0) continue;
+
+                uint32_t draw = gbuffer.GetDraw(x, y, slot);
+                if (draw != batch_draw || count == FragmentBatch::kMaxSize) {
+                    light_batch();
+                    batch_draw = draw;
+                }
+
+                SurfaceData& surface = surfaces[count];
+                gbuffer.GetSurface(x, y, slot, surface);
+                surface.shadow_coord = gbuffer.draw(draw).shader->ShadowCoord(surface.world_position);
+                pixels[count] = x;
+                coverages[count] = coverage;
+                ++count;
+            }
+        }
+        light_batch();
+        Count(RenderCounter::kPixelLit, lit);
+    };
+
+    //rows are independent, spread them over the pool of the tiled backend if there is one
+    if (thread_pool_) {
+        thread_pool_->ParallelFor(gbuffer.height(), light_row);
+    } else {
+        for (int y = 0; y < gbuffer.height(); ++y) {
+            light_row(y);
+        }
+    }
+}
+
+void Graphics::SetDepthFunc(DepthFunc func) {
+    Flush();
+    depth_func_ = func;
+    if (shader_) {
+        SetWriteDepth(shader_->write_depth() && depth_func_ != DepthFunc::kEqual);
+    }
+}
+
+bool Graphics::Occluded(float min_z, float max_depth) const {
+    //an equal test can still pass on samples exactly at the farthest depth
+    return depth_func_ == DepthFunc::kEqual ? min_z > max_depth : min_z >= max_depth;
 }
 
 void Graphics::SetClipDistance(float near, float far) {
@@ -38,33 +305,102 @@ void Graphics::SetClipDistance(float near, float far) {
 }
 
 void Graphics::SetRenderType(Primitive type) {
+    Flush();
     render_type_ = type;
 }
 
 void Graphics::SetWriteDepth(bool on) {
+    Flush();
     write_depth_ = on;
+    SelectKernels();
 }
 
 void Graphics::SetWriteColor(bool on) {
+    Flush();
     write_color_ = on;
+    //without color writes fragments are never shaded, only positions are needed
+    varyings_ = write_color_ && shader_ ? shader_->varyings() : Varyings::kNone;
+    SelectKernels();
+}
+
+void Graphics::SelectKernels() {
+    switch (render_texture_ ? render_texture_->sample_size() : 1) {
+    case 8:
+        rasterize_ = SelectRasterizer<8>();
+        break;
+    case 4:
+        rasterize_ = SelectRasterizer<4>();
+        break;
+    case 2:
+        rasterize_ = SelectRasterizer<2>();
+        break;
+    default:
+        rasterize_ = SelectRasterizer<1>();
+        break;
+    }
+
+    switch (cull_) {
+    case CullMode::kBack:
+        assemble_ = &Graphics::AssembleTriangle<CullMode::kBack>;
+        break;
+    case CullMode::kFront:
+        assemble_ = &Graphics::AssembleTriangle<CullMode::kFront>;
+        break;
+    default:
+        assemble_ = &Graphics::AssembleTriangle<CullMode::kNone>;
+        break;
+    }
+}
+
+template <int kSamples>
+Graphics::RasterizeFunc Graphics::SelectRasterizer() const {
+    if (write_depth_) {
+        return write_color_ ? &Graphics::RasterizeEdgeEquation<kSamples, true, true> :
+            &Graphics::RasterizeEdgeEquation<kSamples, true, false>;
+    }
+    return write_color_ ? &Graphics::RasterizeEdgeEquation<kSamples, false, true> :
+        &Graphics::RasterizeEdgeEquation<kSamples, false, false>;
 }
 
 void Graphics::SetCullMode(CullMode mode) { 
+    Flush();
     cull_ = mode;
+    SelectKernels();
 }
 
-VertexOut Graphics::Lerp(const VertexOut& v0, const VertexOut& v1, float w) {
-    VertexOut o;
-    o.w_reciprocal = math::Lerp(v0.w_reciprocal, v1.w_reciprocal, w);
-    o.position = Vec4f::Lerp(v0.position, v1.position, w);
-    o.world_position = Vec3f::Lerp(v0.world_position, v1.world_position, w);
-    o.color = Vec4f::Lerp(v0.color, v1.color, w);
-    o.normal = Vec3f::Lerp(v0.normal, v1.normal, w);
-    o.tangent = Vec3f::Lerp(v0.tangent, v1.tangent, w);
-    o.texcoord = Vec2f::Lerp(v0.texcoord, v1.texcoord, w);
-    o.shadow_coord = Vec3f::Lerp(v0.shadow_coord, v1.shadow_coord, w);
-    
-    return o;
+int Graphics::PackVertex(const VertexOut& v, Varyings varyings, float* out) {
+    auto has = [varyings](Varyings f) { return (varyings & f) == f; };
+    int n = 0;
+    auto put = [&](const auto& attr, int size) {
+        for (int i = 0; i < size; ++i) {
+            out[n++] = attr[i];
+        }
+    };
+    put(v.position, 4);
+    if (has(Varyings::kWorldPosition)) put(v.world_position, 3);
+    if (has(Varyings::kColor)) put(v.color, 4);
+    if (has(Varyings::kNormal)) put(v.normal, 3);
+    if (has(Varyings::kTangent)) put(v.tangent, 3);
+    if (has(Varyings::kTexcoord)) put(v.texcoord, 2);
+    if (has(Varyings::kShadowCoord)) put(v.shadow_coord, 3);
+    return n;
+}
+
+void Graphics::UnpackVertex(const float* in, Varyings varyings, VertexOut& v) {
+    auto has = [varyings](Varyings f) { return (varyings & f) == f; };
+    int n = 0;
+    auto get = [&](auto& attr, int size) {
+        for (int i = 0; i < size; ++i) {
+            attr[i] = in[n++];
+        }
+    };
+    get(v.position, 4);
+    if (has(Varyings::kWorldPosition)) get(v.world_position, 3);
+    if (has(Varyings::kColor)) get(v.color, 4);
+    if (has(Varyings::kNormal)) get(v.normal, 3);
+    if (has(Varyings::kTangent)) get(v.tangent, 3);
+    if (has(Varyings::kTexcoord)) get(v.texcoord, 2);
+    if (has(Varyings::kShadowCoord)) get(v.shadow_coord, 3);
 }
 
 VertexOut Graphics::RasterizeLerp(const VertexOut& v0, const VertexOut& v1, float w) {
@@ -81,43 +417,79 @@ VertexOut Graphics::RasterizeLerp(const VertexOut& v0, const VertexOut& v1, floa
     return o;
 }
 
-void Graphics::Clip(const VertexOut& v0, const VertexOut& v1, const VertexOut& v2, std::vector<VertexOut>& output) {
-    output.push_back(v0);
-    output.push_back(v1);
-    output.push_back(v2);
+int Graphics::Outcode(const Vec4f& pos, float guard_x, float guard_y) {
+    float scale[] = { guard_x, guard_y, 1.0f };
+    int code = 0;
+    for (int i = 0; i < kClipPlaneCount; ++i) {
+        const ClipPlane& plane = kClipPlanes[i];
+        if (!plane.Inside(pos, scale[static_cast<int>(plane.axis)])) {
+            code |= 1 << i;
+        }
+    }
+    return code;
+}
 
-    if (v0.InsideFrustum(near_, far_) && v1.InsideFrustum(near_, far_) && v2.InsideFrustum(near_, far_)) {
-        return;
+int Graphics::Clip(const VertexOut* triangle, int planes, Varyings varyings, VertexOut* output) {
+    //ping-pong between two polygons of packed vertices, one pass per crossed plane.
+    //a vertex is stride floats, the position and the varyings of the mask
+    float polygons[2][kMaxClipVertices * kMaxClipFloats];
+    float* input = polygons[1];
+    float* result = polygons[0];
+    int stride = 0;
+    for (int i = 0; i < 3; ++i) {
+        stride = PackVertex(triangle[i], varyings, result + i * kMaxClipFloats);
     }
+    int count = 3;
 
-    for (auto& plane : kClipPlanes) {
-        clip_input_.swap(output);
-        output.clear();
+    auto lerp = [stride](const float* v0, const float* v1, float t, float* out) {
+        for (int i = 0; i < stride; ++i) {
+            out[i] = math::Lerp(v0[i], v1[i], t);
+        }
+    };
 
-        for (int j = 0; j < clip_input_.size(); j++) {
-            const VertexOut& current = clip_input_[j];
-            int last_idx = j - 1;
-            if (last_idx < 0) {
-                last_idx = clip_input_.size() - 1;
-            }
-            const VertexOut& last = clip_input_[last_idx];
+    for (int i = 0; i < kClipPlaneCount && count > 0; ++i) {
+        if (!(planes & (1 << i))) continue;
+
+        const ClipPlane& plane = kClipPlanes[i];
+        std::swap(input, result);
+        int input_count = count;
+        count = 0;
+
+        for (int j = 0; j < input_count; j++) {
+            const float* current = input + j * kMaxClipFloats;
+            const float* last = input + (j > 0 ? j - 1 : input_count - 1) * kMaxClipFloats;
+            Vec4f current_pos(current[0], current[1], current[2], current[3]);
+            Vec4f last_pos(last[0], last[1], last[2], last[3]);
 
-            if (plane.Inside(current.position)) {
-                if (!plane.Inside(last.position)) {
-                    float t = plane.Intersect(current.position, last.position);
-                    VertexOut intersect = Lerp(current, last, t);
-                    output.push_back(intersect);
+            if (plane.Inside(current_pos)) {
+                if (!plane.Inside(last_pos)) {
+                    float t = plane.Intersect(current_pos, last_pos);
+                    lerp(current, last, t, result + count++ * kMaxClipFloats);
                 }
-                output.push_back(current);
-            } else if (plane.Inside(last.position)) {
-                float t = plane.Intersect(last.position, current.position);
-                VertexOut intersect = Lerp(last, current, t);
-                output.push_back(intersect);
+                std::copy(current, current + stride, result + count++ * kMaxClipFloats);
+            } else if (plane.Inside(last_pos)) {
+                float t = plane.Intersect(last_pos, current_pos);
+                lerp(last, current, t, result + count++ * kMaxClipFloats);
             }
         }
     }
 
-    clip_input_.clear();
+    for (int i = 0; i < count; ++i) {
+        UnpackVertex(result + i * kMaxClipFloats, varyings, output[i]);
+    }
+    return count;
+}
+
+Graphics::ClipCodes Graphics::ClassifyVertex(const Vec4f& pos) const {
+    //lines are clamped to the target per end point and need exact clipping, triangles are
+    //only clipped when they cross the near or far plane or leave the guard band
+    float guard_x = 1.0f;
+    float guard_y = 1.0f;
+    if (render_type_ != Primitive::kLine) {
+        guard_x += 2.0f * kGuardBand / render_texture_->width();
+        guard_y += 2.0f * kGuardBand / render_texture_->height();
+    }
+    return { (uint8_t)Outcode(pos, 1.0f, 1.0f), (uint8_t)Outcode(pos, guard_x, guard_y) };
 }
 
 void Graphics::DrawTriangle(const Vertex& v0, const Vertex& v1, const Vertex& v2) {
@@ -128,12 +500,90 @@ void Graphics::DrawTriangle(const Vertex& v0, const Vertex& v1, const Vertex& v2
     VertexOut vo0 = shader_->Vert(v0);
     VertexOut vo1 = shader_->Vert(v1);
     VertexOut vo2 = shader_->Vert(v2);
+    Count(RenderCounter::kVertexShaded, 3);
+
+    (this->*assemble_)(vo0, vo1, vo2, ClassifyVertex(vo0.position), ClassifyVertex(vo1.position), ClassifyVertex(vo2.position));
+}
+
+void Graphics::DrawIndexed(const std::vector<Vertex>& vertices, const std::vector<Mesh::TriangleIndex>& triangles) {
+    assert(shader_);
+    assert(render_texture_);
+
+    //vert shader, once per vertex
+    int count = (int)vertices.size();
+    vertex_outs_.resize(count);
+    vertex_codes_.resize(count);
+    auto shade = [&](int chunk) {
+        int begin = chunk * kVertexChunk;
+        int end = math::Min(begin + kVertexChunk, count);
+        shader_->VertBatch(&vertices[begin], end - begin, &vertex_outs_[begin]);
+        for (int i = begin; i < end; ++i) {
+            vertex_codes_[i] = ClassifyVertex(vertex_outs_[i].position);
+        }
+    };
+
+    int chunks = (count + kVertexChunk - 1) / kVertexChunk;
+    if (thread_pool_) {
+        thread_pool_->ParallelFor(chunks, shade);
+    } else {
+        for (int i = 0; i < chunks; ++i) {
+            shade(i);
+        }
+    }
+    Count(RenderCounter::kVertexShaded, count);
+
+    //primitive assembly from the shaded vertices
+    for (auto& tri : triangles) {
+        (this->*assemble_)(
+            vertex_outs_[tri[0]], vertex_outs_[tri[1]], vertex_outs_[tri[2]],
+            vertex_codes_[tri[0]], vertex_codes_[tri[1]], vertex_codes_[tri[2]]
+        );
+    }
+}
+
+template <CullMode kCull>
+void Graphics::AssembleTriangle(const VertexOut& v0, const VertexOut& v1, const VertexOut& v2, ClipCodes c0, ClipCodes c1, ClipCodes c2) {
+    //all vertices outside the same plane
+    if (c0.frustum & c1.frustum & c2.frustum) {
+        Count(RenderCounter::kTriangleRejected);
+        return;
+    }
+
+    //facing from the determinant of the (x, y, w) rows, it gives the winding of the visible
+    //part in screen space even for triangles crossing w = 0, so no divide is needed
+    const Vec4f& p0 = v0.position;
+    const Vec4f& p1 = v1.position;
+    const Vec4f& p2 = v2.position;
+    float det = p0.x * (p1.y * p2.w - p2.y * p1.w) -
+        p1.x * (p0.y * p2.w - p2.y * p0.w) +
+        p2.x * (p0.y * p1.w - p1.y * p0.w);
+    bool is_front = det < 0.0f;
+
+    if ((kCull == CullMode::kBack && !is_front) ||
+        (kCull == CullMode::kFront && is_front)) {
+        Count(RenderCounter::kTriangleCulled);
+        return;
+    }
+
+    VertexOut triangle[3] = { v0, v1, v2 };
+    int clip = c0.clip | c1.clip | c2.clip;
+    if (!clip) {
+        DrawPolygon(triangle, 3, is_front);
+        return;
+    }
+
+    Count(RenderCounter::kTriangleClipped);
+    VertexOut polygon[kMaxClipVertices];
+    int count = Clip(triangle, clip, varyings_, polygon);
+    DrawPolygon(polygon, count, is_front);
+}
 
-    //Cliping
-    Clip(vo0, vo1, vo2, clip_output_);
+void Graphics::DrawPolygon(VertexOut* polygon, int count, bool is_front) {
+    if (count < 3) return;
 
     //Homogeneous division
-    for (auto& vert : clip_output_) {
+    for (int i = 0; i < count; ++i) {
+        VertexOut& vert = polygon[i];
         vert.w_reciprocal = 1.0f / vert.position.w;
         vert.position *= vert.w_reciprocal;
     }
@@ -141,76 +591,333 @@ void Graphics::DrawTriangle(const Vertex& v0, const Vertex& v1, const Vertex& v2
     //Viewport transformation
     int width = render_texture_->width();
     int height = render_texture_->height();
-    for (auto& vert : clip_output_) {
-        Vec4f& pos = vert.position;
+    for (int i = 0; i < count; ++i) {
+        Vec4f& pos = polygon[i].position;
         pos.x = 0.5f * width * (pos.x + 1.0f);
         pos.y = 0.5f * height * (pos.y + 1.0f);
         pos.z = 0.5f * (pos.z + 1.0f);
     }
 
-    if (clip_output_.size() == 0) return;
-
     //rasterize
-    for (int i = 0; i < clip_output_.size() - 3 + 1; ++i) {
-        auto& o0 = clip_output_[0];
-        auto& o1 = clip_output_[i + 1];
-        auto& o2 = clip_output_[i + 2];
-        
-        bool is_front = (o1.position.y - o0.position.y) * (o2.position.x - o0.position.x) -
-            (o1.position.x - o0.position.x) * (o2.position.y - o0.position.y) > 0.0f;
-
-        if ((cull_ == CullMode::kBack && !is_front) ||
-            (cull_ == CullMode::kFront && is_front))
-            break;
+    for (int i = 0; i < count - 3 + 1; ++i) {
+        auto& o0 = polygon[0];
+        auto& o1 = polygon[i + 1];
+        auto& o2 = polygon[i + 2];
 
         if (render_type_ == Primitive::kLine) {
             DrawLine(o0.position, o1.position, Vec4f(0.0f, 1.0f, 0.0f, 1.0f));
             DrawLine(o1.position, o2.position, Vec4f(0.0f, 1.0f, 0.0f, 1.0f));
             DrawLine(o2.position, o0.position, Vec4f(0.0f, 1.0f, 0.0f, 1.0f));
         } else {
-            if (is_front) {
-                RasterizeEdgeEquation(o0, o1, o2);
+            const VertexOut& a = o0;
+            const VertexOut& b = is_front ? o1 : o2;
+            const VertexOut& c = is_front ? o2 : o1;
+
+            uint32_t id = 0;
+            if (visibility_draw_ >= 0) {
+                visibility_triangles_.push_back({ a, b, c, (uint32_t)visibility_draw_ });
+                id = (uint32_t)visibility_triangles_.size();
+            }
+
+            if (backend_ == RasterBackend::kTiled) {
+                BinTriangle(a, b, c, id);
             } else {
-                RasterizeEdgeEquation(o0, o2, o1);
+                RasterizeEdgeEquation(a, b, c, id);
             }
         }
     }
+}
 
-    clip_output_.clear();
+void Graphics::RasterizeEdgeEquation(const VertexOut& v0, const VertexOut& v1, const VertexOut& v2, uint32_t id) {
+    //triangles that only write their id to the visibility buffer are not interpolated
+    ScreenTriangle tri(v0, v1, v2, render_texture_, id ? Varyings::kNone : varyings_);
+    tri.id = id;
+    (this->*rasterize_)(tri, tri.min, tri.max);
 }
 
-void Graphics::RasterizeEdgeEquation(const VertexOut& v0, const VertexOut& v1, const VertexOut& v2) {
-    ScreenTriangle tri(v0, v1, v2, render_texture_);
-    for (int x = tri.min.x; x <= tri.max.x; ++x) {
-        for (int y = tri.min.y; y <= tri.max.y; ++y) {
-            RasterizePixel(tri, x, y);
+template <int kSamples, bool kWriteDepth, bool kWriteColor>
+void Graphics::RasterizeEdgeEquation(const ScreenTriangle& tri, const Vec2i& min, const Vec2i& max) {
+    if (min.x > max.x || min.y > max.y) return;
+
+    if (!tri.block_coverage) {
+        //step the fixed point edge functions incrementally, one 2x2 quad at a time
+        Vec2i quad_min(min.x & ~1, min.y & ~1);
+        EdgeValues quad_step_x = tri.step_x * (int64_t)2;
+        EdgeValues quad_step_y = tri.step_y * (int64_t)2;
+        EdgeValues row = tri.EdgeEquation(quad_min.x, quad_min.y);
+        for (int y = quad_min.y; y <= max.y; y += 2) {
+            EdgeValues edge = row;
+            for (int x = quad_min.x; x <= max.x; x += 2) {
+                RasterizeQuad<kSamples, kWriteDepth, kWriteColor>(tri, x, y, edge, min, max);
+                edge += quad_step_x;
+            }
+            row += quad_step_y;
         }
+        return;
+    }
+
+    //hierarchical traversal: skip blocks outside the triangle, no edge tests for blocks fully inside it
+    for (int by = min.y - min.y % kCoarseBlockSize; by <= max.y; by += kCoarseBlockSize) {
+        for (int bx = min.x - min.x % kCoarseBlockSize; bx <= max.x; bx += kCoarseBlockSize) {
+            Vec2i block_min(math::Max(bx, min.x), math::Max(by, min.y));
+            Vec2i block_max(math::Min(bx + kCoarseBlockSize - 1, max.x), math::Min(by + kCoarseBlockSize - 1, max.y));
+
+            BlockClass cls = tri.ClassifyBlock(bx, by, kCoarseBlockSize, kCoarseBlockSize);
+            if (cls == BlockClass::kOutside) {
+                Count(RenderCounter::kBlockRejected);
+            } else if (Occluded(tri.min_z, render_texture_->GetMaxDepth(0, bx / kCoarseBlockSize, by / kCoarseBlockSize))) {
+                Count(RenderCounter::kBlockOccluded);
+            } else if (cls == BlockClass::kInside && block_min.x == bx && block_min.y == by &&
+                block_max.x == bx + kCoarseBlockSize - 1 && block_max.y == by + kCoarseBlockSize - 1) {
+                Count(RenderCounter::kBlockAccepted);
+                RasterizeBlocks<kSamples, kWriteDepth, kWriteColor, false>(tri, block_min, block_max);
+            } else {
+                //blocks cut by the bounding box or a tile are partial as well, only the slots inside it are touched
+                Count(RenderCounter::kBlockPartial);
+                RasterizeBlocks<kSamples, kWriteDepth, kWriteColor, true>(tri, block_min, block_max);
+            }
+        }
+    }
+}
+
+void Graphics::BinTriangle(const VertexOut& v0, const VertexOut& v1, const VertexOut& v2, uint32_t id) {
+    ScreenTriangle tri(v0, v1, v2, render_texture_, Varyings::kNone);
+    if (tri.min.x > tri.max.x || tri.min.y > tri.max.y) return;
+
+    uint32_t index = bin_triangles_.size();
+    bin_triangles_.push_back({v0, v1, v2, id});
+
+    int col_min = tri.min.x / kTileSize;
+    int col_max = tri.max.x / kTileSize;
+    int row_min = tri.min.y / kTileSize;
+    int row_max = tri.max.y / kTileSize;
+    for (int row = row_min; row <= row_max; ++row) {
+        for (int col = col_min; col <= col_max; ++col) {
+            tile_bins_[row * tile_cols_ + col].push_back(index);
+        }
+    }
+}
+
+void Graphics::Flush() {
+    if (bin_triangles_.empty()) return;
+
+    thread_pool_->ParallelFor(tile_bins_.size(), [this](int tile) {
+        RasterizeTile(tile);
+    });
+
+    bin_triangles_.clear();
+    for (auto& bin : tile_bins_) {
+        bin.clear();
     }
 }
 
-void Graphics::RasterizePixel(const ScreenTriangle& tri, int x, int y) {
+void Graphics::Resolve(ResolveFilter filter) {
+    Flush();
+    render_texture_->Resolve(filter, thread_pool_.get());
+}
+
+void Graphics::RasterizeTile(int tile) {
+    Vec2i tile_min((tile % tile_cols_) * kTileSize, (tile / tile_cols_) * kTileSize);
+    Vec2i tile_max(tile_min.x + kTileSize - 1, tile_min.y + kTileSize - 1);
+
+    for (uint32_t index : tile_bins_[tile]) {
+        const BinnedTriangle& binned = bin_triangles_[index];
+        float min_z = math::Min(binned.v0.position.z, math::Min(binned.v1.position.z, binned.v2.position.z));
+        if (Occluded(min_z, render_texture_->GetMaxDepth(1, tile % tile_cols_, tile / tile_cols_))) {
+            Count(RenderCounter::kTileOccluded);
+            continue;
+        }
+
+        ScreenTriangle tri(binned.v0, binned.v1, binned.v2, render_texture_, binned.id ? Varyings::kNone : varyings_);
+        tri.id = binned.id;
+        Vec2i min(math::Max(tri.min.x, tile_min.x), math::Max(tri.min.y, tile_min.y));
+        Vec2i max(math::Min(tri.max.x, tile_max.x), math::Min(tri.max.y, tile_max.y));
+        (this->*rasterize_)(tri, min, max);
+    }
+}
+
+template <int kSamples, bool kWriteDepth, bool kWriteColor, bool kEdgeTest>
+void Graphics::RasterizeBlocks(const ScreenTriangle& tri, const Vec2i& min, const Vec2i& max) {
+    //walk pairs of rows of blocks aligned to the block width, so a block never straddles a row
+    //of the depth buffer and every 2x2 quad lies within one block
+    constexpr int block_width = BlockWidth<kSamples>();
+    int block_min = min.x - min.x % block_width;
+    int block_limit = render_texture_->width() - block_width;
+    EdgeValues block_step = tri.step_x * (int64_t)block_width;
+    EdgeValues quad_step_x = tri.step_x * (int64_t)2;
+    EdgeValues quad_step_y = tri.step_y * (int64_t)2;
+
+    int quad_y = min.y & ~1;
+    EdgeValues row = tri.EdgeEquation(block_min, quad_y);
+    for (int y = quad_y; y <= max.y; y += 2) {
+        EdgeValues edge = row;
+        for (int x = block_min; x <= max.x; x += block_width) {
+            if (x <= block_limit) {
+                RasterizeBlock<kSamples, kWriteDepth, kWriteColor, kEdgeTest>(tri, x, y, edge, min, max);
+            } else {
+                //partial block at the right border of the target
+                EdgeValues e = edge;
+                for (int qx = x; qx <= max.x; qx += 2) {
+                    RasterizeQuad<kSamples, kWriteDepth, kWriteColor>(tri, qx, y, e, min, max);
+                    e += quad_step_x;
+                }
+            }
+            edge += block_step;
+        }
+        row += quad_step_y;
+    }
+}
+
+template <int kSamples, bool kWriteDepth, bool kWriteColor, bool kEdgeTest>
+void Graphics::RasterizeBlock(const ScreenTriangle& tri, int x, int y, const EdgeValues& edge, const Vec2i& min, const Vec2i& max) {
+    constexpr int block_width = BlockWidth<kSamples>();
+    if (kEdgeTest) {
+        //blocks of a partial 8x8 block are mostly on one side of the edges as well
+        BlockClass cls = tri.ClassifyBlock(x, y, block_width, 2);
+        if (cls == BlockClass::kOutside) return;
+        if (cls == BlockClass::kInside) {
+            RasterizeBlock<kSamples, kWriteDepth, kWriteColor, false>(tri, x, y, edge, min, max);
+            return;
+        }
+    }
+
+    //more than one coverage block per row if a pixel has as many samples as a block has slots
+    constexpr int block_pixels = ScreenTriangle::kBlockSlots / kSamples;
+    constexpr int coverage_blocks = block_width / block_pixels;
+    float depth[2][block_width * kSamples];
+    float stored[ScreenTriangle::kBlockSlots]; //samples of plane compressed depth blocks
+    int mask[2] = { 0, 0 };
+    for (int r = 0; r < 2; ++r) {
+        if (y + r < min.y || y + r > max.y) continue;
+        EdgeValues e = r == 0 ? edge : edge + tri.step_y;
+        for (int b = 0; b < coverage_blocks; ++b, e += tri.step_x * (int64_t)block_pixels) {
+            int slot = b * ScreenTriangle::kBlockSlots;
+            int bx = x + b * block_pixels;
+            const float* samples = render_texture_->GetDepthSamples(bx, y + r, ScreenTriangle::kBlockSlots, stored);
+            mask[r] |= tri.CoverageBlock<kEdgeTest>(e, bx, y + r, samples, depth_func_, depth[r] + slot) << slot;
+        }
+    }
+    if ((mask[0] | mask[1]) == 0) return;
+
+    constexpr int pixel_bits = (1 << kSamples) - 1;
+    FragmentQueue queue;
+    for (int i = 0; i < block_width; i += 2) {
+        int quad_mask[4];
+        const float* quad_depth[4];
+        for (int lane = 0; lane < 4; ++lane) {
+            int column = i + (lane & 1);
+            int r = lane >> 1;
+            bool inside = x + column >= min.x && x + column <= max.x;
+            quad_mask[lane] = inside ? (mask[r] >> (column * kSamples)) & pixel_bits : 0;
+            quad_depth[lane] = depth[r] + column * kSamples;
+        }
+        ShadeQuad<kSamples, kWriteDepth, kWriteColor>(tri, x + i, y, quad_mask, quad_depth, queue);
+    }
+    //all fragments of the block in one batch
+    ShadeFragments<kSamples>(queue);
+}
+
+template <int kSamples>
+int Graphics::CoverPixel(const ScreenTriangle& tri, int x, int y, const EdgeValues& edge, const Vec2i& min, const Vec2i& max, float* depth) {
+    if (x < min.x || x > max.x || y < min.y || y > max.y) return 0;
+
+    //only pixels crossed by an edge test every sample against the edges
+    BlockClass cls = tri.ClassifyPixel(edge);
+    if (cls == BlockClass::kOutside) return 0;
+
     Vec2i pixel(x, y);
     int mask = 0;
-    int samples = render_texture_->sample_size();
-    for (int i = 0; i < samples; ++i) {
-        Vec2f pos = render_texture_->GetSubSample(x, y, i);
-        float depth;
-        if (tri.Coverage(pos, pixel, i, depth)) {
-            mask |= (1 << i);
-            if (write_depth_) {
-                render_texture_->SetDepth(x, y, depth, i);
+    if (cls == BlockClass::kInside) {
+        for (int i = 0; i < kSamples; ++i) {
+            if (tri.Coverage<false>(edge, pixel, i, depth_func_, depth[i])) {
+                mask |= (1 << i);
             }
         }
+        return mask;
     }
-    if (mask == 0) return;
 
-    if (write_color_) {
-        VertexOut o = tri.Rasterize(x + 0.5f, y + 0.5f);
-        Vec4f color = shader_->Frag(o);
-        for (int i = 0; i < samples; ++i) {
-            if ((mask & (1 << i)) != 0) {
-                render_texture_->SetColor(x, y, color, i);
+    for (int i = 0; i < kSamples; ++i) {
+        if (tri.Coverage(edge, pixel, i, depth_func_, depth[i])) {
+            mask |= (1 << i);
+        }
+    }
+    return mask;
+}
+
+template <int kSamples, bool kWriteDepth, bool kWriteColor>
+void Graphics::RasterizeQuad(const ScreenTriangle& tri, int x, int y, const EdgeValues& edge, const Vec2i& min, const Vec2i& max) {
+    float depth[4][RenderTexture::kMaxSampleSize];
+    int mask[4];
+    const float* quad_depth[4] = { depth[0], depth[1], depth[2], depth[3] };
+    mask[0] = CoverPixel<kSamples>(tri, x, y, edge, min, max, depth[0]);
+    mask[1] = CoverPixel<kSamples>(tri, x + 1, y, edge + tri.step_x, min, max, depth[1]);
+    mask[2] = CoverPixel<kSamples>(tri, x, y + 1, edge + tri.step_y, min, max, depth[2]);
+    mask[3] = CoverPixel<kSamples>(tri, x + 1, y + 1, edge + tri.step_x + tri.step_y, min, max, depth[3]);
+    FragmentQueue queue;
+    ShadeQuad<kSamples, kWriteDepth, kWriteColor>(tri, x, y, mask, quad_depth, queue);
+    ShadeFragments<kSamples>(queue);
+}
+
+template <int kSamples, bool kWriteDepth, bool kWriteColor>
+void Graphics::ShadeQuad(const ScreenTriangle& tri, int x, int y, const int* mask, const float* const* depth,
+    FragmentQueue& queue)
+{
+    if ((mask[0] | mask[1] | mask[2] | mask[3]) == 0) return;
+
+    if (kWriteDepth) {
+        for (int lane = 0; lane < 4; ++lane) {
+            render_texture_->SetDepthSamples(x + (lane & 1), y + (lane >> 1), mask[lane], depth[lane], tri.depth_plane);
+        }
+    }
+
+    if (kWriteColor && tri.id != 0) {
+        //visibility buffer: remember the triangle, it is shaded once the visible one is known
+        for (int lane = 0; lane < 4; ++lane) {
+            for (int i = 0; i < kSamples; ++i) {
+                if ((mask[lane] & (1 << i)) != 0) {
+                    render_texture_->SetId(x + (lane & 1), y + (lane >> 1), tri.id, i);
+                }
+            }
+        }
+    } else if (kWriteColor) {
+        //uncovered lanes are interpolated as well, so every fragment has derivatives
+        assert(queue.quad_count < FragmentQueue::kMaxQuads);
+        VertexOut* quad = queue.quads[queue.quad_count++];
+        tri.RasterizeQuad(x, y, quad);
+        for (int lane = 0; lane < 4; ++lane) {
+            if (mask[lane] == 0) continue;
+
+            int px = x + (lane & 1);
+            int py = y + (lane >> 1);
+            //fragments that would need a third surface in the pixel are shaded forward instead
+            if (gbuffer_draw_ != 0 && gbuffer_->HasRoom(px, py, mask[lane])) {
+                SurfaceData surface;
+                shader_->Surface(quad[lane], surface);
+                Count(RenderCounter::kFragmentShaded);
+                gbuffer_->SetSurface(px, py, surface, gbuffer_draw_, mask[lane]);
+                continue;
             }
+
+            int n = queue.batch.size++;
+            queue.batch.fragments[n] = &quad[lane];
+            queue.pixels[n] = Vec2i(px, py);
+            queue.masks[n] = mask[lane];
+        }
+    }
+}
+
+template <int kSamples>
+void Graphics::ShadeFragments(FragmentQueue& queue) {
+    if (queue.batch.size == 0) return;
+
+    Vec4f colors[FragmentBatch::kMaxSize];
+    shader_->FragBatch(queue.batch, colors);
+    Count(RenderCounter::kFragmentShaded, queue.batch.size);
+    for (int n = 0; n < queue.batch.size; ++n) {
+        const Vec2i& pixel = queue.pixels[n];
+        render_texture_->SetColorSamples(pixel.x, pixel.y, colors[n], queue.masks[n]);
+        if (gbuffer_) {
+            gbuffer_->ClearSamples(pixel.x, pixel.y, queue.masks[n]);
         }
     }
 }
@@ -293,7 +1000,7 @@ void Graphics::RasterizeFlatTriangle(const VertexOut* v0, const VertexOut* v1, c
         std::swap(ry_min, ry_max);
     }
 
-    ScreenTriangle tri(*v0, *v1, *v2, render_texture_);
+    ScreenTriangle tri(*v0, *v1, *v2, render_texture_, varyings_);
     int y = lo - step;
     for (int i = 0; i <= height; ++i) {
         y += step;
@@ -308,7 +1015,9 @@ void Graphics::RasterizeFlatTriangle(const VertexOut* v0, const VertexOut* v1, c
         
         for (int x = lx; x <= rx; ++x) {
             if (x < tri.min.x || x > tri.max.x) continue;;
-            RasterizePixel(tri, x, y);
+            //a single pixel, its quad still feeds the derivatives
+            Vec2i pixel(x, y);
+            (this->*rasterize_)(tri, pixel, pixel);
         }
     }
 }
@@ -1,11 +1,17 @@
 #pragma once
 
 #include <vector>
+#include <memory>
+#include <optional>
 #include "common/singleton.h"
+#include "common/thread_pool.h"
 #include "rendertexture.h"
 #include "vertex.h"
 #include "types.h"
 #include "screen_triangle.h"
+#include "gbuffer.h"
+#include "uniform.h"
+#include "mesh.h"
 
 namespace rendertoy {
 
@@ -15,21 +21,83 @@ struct Camera;
 class Graphics : public Singleton<Graphics> {
 public:
     void SetRenderTarget(RenderTexture* rt);
-    void SetShader(const Shader* shader);
+    void SetShader(Shader* shader);
     void SetClipDistance(float near, float far);
     void SetRenderType(Primitive type);
 
     void SetWriteDepth(bool on);
     void SetWriteColor(bool on);
     void SetCullMode(CullMode mode);
+    //kept across SetShader, kEqual also turns depth writes off
+    void SetDepthFunc(DepthFunc func);
+    DepthFunc depth_func() const { return depth_func_; }
+
+    //thread_count <= 0 means one thread per hardware core, only used by the tiled backend
+    void SetBackend(RasterBackend backend, int thread_count = 0);
+    RasterBackend backend() const { return backend_; }
+
+    //geometry pass of deferred shading: deferred shaders write surfaces to the g-buffer instead of colors,
+    //forward shaded fragments clear the samples they cover. fragments that would need a third surface in a pixel
+    //are shaded forward as well. nullptr goes back to forward shading
+    void SetGBuffer(GBuffer* gbuffer);
+    //lighting pass of deferred shading: light every surface of the g-buffer into the render target
+    void DrawGBuffer(const GBuffer& gbuffer);
+
+    //visibility buffer: shaders that write color only store the id of the visible triangle per sample
+    //until ResolveVisibilityBuffer shades every visible triangle once per pixel with its own draw state
+    void BeginVisibilityBuffer();
+    void ResolveVisibilityBuffer();
+
+    //rasterize everything binned so far, must be called before the uniform of the current draw changes
+    void Flush();
+    //finish the frame and resolve the samples of the render target, on the thread pool of the tiled backend
+    void Resolve(ResolveFilter filter);
+
+    uint64_t counter(RenderCounter c) const { return counters_[(int)c].load(std::memory_order_relaxed); }
+    void ResetCounters();
 
     void DrawLine(const Vec4f& begin, const Vec4f& end, const Vec4f& line_color);
     void DrawTriangle(const Vertex& v0, const Vertex& v1, const Vertex& v2);
+    //runs the vertex shader once per vertex, in parallel on the tiled backend, then draws the
+    //triangles from the shaded vertices
+    void DrawIndexed(const std::vector<Vertex>& vertices, const std::vector<Mesh::TriangleIndex>& triangles);
 
 protected:
     Graphics();
 
 private:
+    static constexpr int kTileSize = 64;
+    //pixels past each border of the target a triangle may reach without clipping, the bounding box
+    //of the screen triangle cuts it to the target. keeps the fixed point edge functions far from overflow
+    static constexpr int kGuardBand = 8192;
+    //vertices shaded per job of DrawIndexed
+    static constexpr int kVertexChunk = 1024;
+    //blocks for the hierarchical traversal, they match hierarchical z level 0 of the render texture
+    static constexpr int kCoarseBlockSize = 1 << RenderTexture::kHiZShift;
+    //a tile is one block of hierarchical z level 1, so a tile never shares a block with another thread
+    static_assert(kTileSize == 1 << (RenderTexture::kHiZShift * 2), "tile size must match the hierarchical z level 1 block size");
+
+    struct BinnedTriangle {
+        VertexOut v0;
+        VertexOut v1;
+        VertexOut v2;
+        uint32_t id;
+    };
+
+    //triangles as rasterized, the visibility buffer stores index + 1
+    struct VisibilityTriangle {
+        VertexOut v0;
+        VertexOut v1;
+        VertexOut v2;
+        uint32_t draw;
+    };
+
+    struct VisibilityDraw {
+        Shader* shader;
+        Uniform uniform; //copied, the pipeline changes it between draws
+        int shadow_light; //index of the shadow casting light in uniform.lights, -1 for none
+    };
+
     static constexpr ClipPlane kClipPlanes[] = {
         {math::Axis::kX, 1.0f},
         {math::Axis::kX, -1.0f},
@@ -38,20 +106,97 @@ private:
         {math::Axis::kZ, 1.0f},
         {math::Axis::kZ, -1.0f}
     };
+    static constexpr int kClipPlaneCount = sizeof(kClipPlanes) / sizeof(kClipPlanes[0]);
+    //every clip plane adds at most one vertex to the polygon
+    static constexpr int kMaxClipVertices = 3 + kClipPlaneCount;
         
     static VertexOut RasterizeLerp(const VertexOut& v0, const VertexOut& v1, float w);
-    static VertexOut Lerp(const VertexOut& v0, const VertexOut& v1, float w);
+    //the clipper moves vertices packed to the position and the varyings of the shader, so a depth only
+    //pass copies 4 floats per vertex instead of a whole VertexOut. kMaxClipFloats with every varying
+    static constexpr int kMaxClipFloats = 22;
+    //writes the packed vertex to out and returns its float count
+    static int PackVertex(const VertexOut& v, Varyings varyings, float* out);
+    static void UnpackVertex(const float* in, Varyings varyings, VertexOut& v);
 
-    void RasterizeEdgeEquation(const VertexOut& v0, const VertexOut& v1, const VertexOut& v2);
-    void RasterizePixel(const ScreenTriangle& tri, int x, int y);
+    //raster kernels are instantiated per sample count and depth and color writes, so the inner loops
+    //have no state branches. rasterize_ points at the one of the current state
+    using RasterizeFunc = void (Graphics::*)(const ScreenTriangle& tri, const Vec2i& min, const Vec2i& max);
+    //pick the kernels for the current state, called whenever it changes
+    void SelectKernels();
+    template <int kSamples>
+    RasterizeFunc SelectRasterizer() const;
+
+    void RasterizeEdgeEquation(const VertexOut& v0, const VertexOut& v1, const VertexOut& v2, uint32_t id);
+    template <int kSamples, bool kWriteDepth, bool kWriteColor>
+    void RasterizeEdgeEquation(const ScreenTriangle& tri, const Vec2i& min, const Vec2i& max);
+    //pixels RasterizeBlock covers at once: as many as fill a CoverageBlock, but at least one 2x2 quad
+    template <int kSamples>
+    static constexpr int BlockWidth() {
+        static_assert(kSamples <= ScreenTriangle::kBlockSlots, "a pixel has to fit in a coverage block");
+        return ScreenTriangle::kBlockSlots / kSamples > 2 ? ScreenTriangle::kBlockSlots / kSamples : 2;
+    }
+    template <int kSamples, bool kWriteDepth, bool kWriteColor, bool kEdgeTest>
+    void RasterizeBlocks(const ScreenTriangle& tri, const Vec2i& min, const Vec2i& max);
+    template <int kSamples, bool kWriteDepth, bool kWriteColor, bool kEdgeTest>
+    void RasterizeBlock(const ScreenTriangle& tri, int x, int y, const EdgeValues& edge, const Vec2i& min, const Vec2i& max);
+    template <int kSamples>
+    int CoverPixel(const ScreenTriangle& tri, int x, int y, const EdgeValues& edge, const Vec2i& min, const Vec2i& max, float* depth);
+    template <int kSamples, bool kWriteDepth, bool kWriteColor>
+    void RasterizeQuad(const ScreenTriangle& tri, int x, int y, const EdgeValues& edge, const Vec2i& min, const Vec2i& max);
+    //fragments of one triangle collected for a single FragBatch call, with the pixel and samples each one covers
+    struct FragmentQueue {
+        static constexpr int kMaxQuads = FragmentBatch::kMaxSize / 4;
+
+        VertexOut quads[kMaxQuads][4];
+        int quad_count = 0;
+        FragmentBatch batch;
+        Vec2i pixels[FragmentBatch::kMaxSize];
+        int masks[FragmentBatch::kMaxSize];
+    };
+    //depth of the 2x2 quad at (x, y), its covered fragments go to the queue.
+    //lane i is pixel (x + (i & 1), y + (i >> 1))
+    template <int kSamples, bool kWriteDepth, bool kWriteColor>
+    void ShadeQuad(const ScreenTriangle& tri, int x, int y, const int* mask, const float* const* depth,
+        FragmentQueue& queue);
+    //shades the queued fragments with one FragBatch call and writes their colors
+    template <int kSamples>
+    void ShadeFragments(FragmentQueue& queue);
 
     void RasterizeEdgeWalking(const VertexOut& v0, const VertexOut& v1, const VertexOut& v2);
     void RasterizeFlatTriangle(const VertexOut* v0, const VertexOut* v1, const VertexOut* v2);
 
-    void Clip(const VertexOut& v0, const VertexOut& v1, const VertexOut& v2, std::vector<VertexOut>& result);
-    
-    std::vector<VertexOut> clip_output_;
-    std::vector<VertexOut> clip_input_;
+    void BinTriangle(const VertexOut& v0, const VertexOut& v1, const VertexOut& v2, uint32_t id);
+    void RasterizeTile(int tile);
+
+    //start a new draw in the g-buffer and visibility buffer for the current shader
+    void AddDraw();
+    void ShadeVisibilityQuad(uint32_t draw, int x, int y, std::optional<ScreenTriangle>& tri);
+
+    bool Occluded(float min_z, float max_depth) const;
+    void Count(RenderCounter c, uint64_t n = 1) { counters_[(int)c].fetch_add(n, std::memory_order_relaxed); }
+
+    struct ClipCodes {
+        uint8_t frustum; //outcode against the view frustum
+        uint8_t clip; //outcode against the planes a triangle has to be clipped to
+    };
+
+    //bit i is set if pos is outside kClipPlanes[i], the x and y planes are scaled by the guard factors
+    static int Outcode(const Vec4f& pos, float guard_x, float guard_y);
+    //clips the triangle against the planes in the mask into output, returns the vertex count of the polygon
+    static int Clip(const VertexOut* triangle, int planes, Varyings varyings, VertexOut* output);
+    ClipCodes ClassifyVertex(const Vec4f& pos) const;
+    //reject, cull and clip a triangle of shaded vertices, then draw it. assemble_ points at the
+    //instance of the current cull mode
+    using AssembleFunc = void (Graphics::*)(const VertexOut& v0, const VertexOut& v1, const VertexOut& v2, ClipCodes c0, ClipCodes c1, ClipCodes c2);
+    template <CullMode kCull>
+    void AssembleTriangle(const VertexOut& v0, const VertexOut& v1, const VertexOut& v2, ClipCodes c0, ClipCodes c1, ClipCodes c2);
+    //projects a convex polygon in clip space to the target and rasterizes it as a fan,
+    //is_front is the winding of the source triangle and is shared by all fan triangles
+    void DrawPolygon(VertexOut* polygon, int count, bool is_front);
+
+    //shaded vertices of the current DrawIndexed
+    std::vector<VertexOut> vertex_outs_;
+    std::vector<ClipCodes> vertex_codes_;
 
     float near_;
     float far_;
@@ -59,10 +204,29 @@ private:
     bool write_depth_;
     bool write_color_;
     CullMode cull_;
+    DepthFunc depth_func_;
 
-    const Shader* shader_;
+    Shader* shader_;
+    GBuffer* gbuffer_;
+    uint32_t gbuffer_draw_; //g-buffer draw id of the current shader, 0 if it is forward shaded
+    bool visibility_;
+    int visibility_draw_; //visibility draw of the current shader, -1 if it is not recorded
+    std::vector<VisibilityTriangle> visibility_triangles_;
+    std::vector<VisibilityDraw> visibility_draws_;
+    Varyings varyings_; //interpolated for the current shader, kNone without color writes
     RenderTexture* render_texture_;
     Primitive render_type_;
+    RasterizeFunc rasterize_;
+    AssembleFunc assemble_;
+
+    RasterBackend backend_;
+    std::unique_ptr<ThreadPool> thread_pool_;
+    std::vector<BinnedTriangle> bin_triangles_;
+    std::vector<std::vector<uint32_t>> tile_bins_; //triangle indices per tile in submission order
+    int tile_cols_;
+    int tile_rows_;
+
+    std::atomic<uint64_t> counters_[(int)RenderCounter::kCount];
 };
 
 }
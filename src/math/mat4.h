@@ -1,7 +1,9 @@
 #pragma once
 
 #include <algorithm>
+#include <stddef.h>
 #include "util.h"
+#include "simd.h"
 #include "vec4.h"
 #include "quat.h"
 
@@ -59,8 +61,32 @@ struct Mat4x4 {
         );
     }
 
+#if RENDERTOY_SSE2
+    //the products of every row with v, transposed so that product k of every row is in one register.
+    //adding them up in order gives the same sums as the scalar code
+    void RowProducts(__m128 v, __m128* products) const {
+        __m128 p0 = _mm_mul_ps(r0.simd(), v);
+        __m128 p1 = _mm_mul_ps(r1.simd(), v);
+        __m128 p2 = _mm_mul_ps(r2.simd(), v);
+        __m128 p3 = _mm_mul_ps(r3.simd(), v);
+        _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+        products[0] = p0;
+        products[1] = p1;
+        products[2] = p2;
+        products[3] = p3;
+    }
+#endif
+
     //scale rotation
     Vec3<T> MultiplyVector(const Vec3<T>& v) const {
+#if RENDERTOY_SSE2
+        if constexpr (Vec4<T>::kSimd) {
+            __m128 p[4];
+            RowProducts(_mm_set_ps(0.0f, v.z, v.y, v.x), p);
+            Vec4<T> res(_mm_add_ps(_mm_add_ps(p[0], p[1]), p[2]));
+            return Vec3<T>(res.x, res.y, res.z);
+        }
+#endif
         return Vec3<T>(
             (r0.x * v.x + r0.y * v.y + r0.z * v.z),
             (r1.x * v.x + r1.y * v.y + r1.z * v.z),
@@ -80,6 +106,14 @@ struct Mat4x4 {
 
     //scale rotation translate
     Vec3<T> MultiplyPoint3X4(const Vec3<T>& v) const {
+#if RENDERTOY_SSE2
+        if constexpr (Vec4<T>::kSimd) {
+            __m128 p[4];
+            RowProducts(_mm_set_ps(1.0f, v.z, v.y, v.x), p);
+            Vec4<T> res(_mm_add_ps(_mm_add_ps(_mm_add_ps(p[0], p[1]), p[2]), p[3]));
+            return Vec3<T>(res.x, res.y, res.z);
+        }
+#endif
         return Vec3<T>(
             (r0.x * v.x + r0.y * v.y + r0.z * v.z + r0.w),
             (r1.x * v.x + r1.y * v.y + r1.z * v.z + r1.w),
@@ -175,8 +209,8 @@ struct Mat4x4 {
             r0 + v.r0,
             r1 + v.r1,
             r2 + v.r2,
-            r3 + v.r3,
-        )
+            r3 + v.r3
+        );
     }
 
     Mat4x4<T>& operator *=(const Mat4x4<T>& v) {
@@ -197,6 +231,13 @@ struct Mat4x4 {
     }
     
     Vec4<T> operator *(const Vec4<T>& v) const {
+#if RENDERTOY_SSE2
+        if constexpr (Vec4<T>::kSimd) {
+            __m128 p[4];
+            RowProducts(v.simd(), p);
+            return Vec4<T>(_mm_add_ps(_mm_add_ps(_mm_add_ps(p[0], p[1]), p[2]), p[3]));
+        }
+#endif
         return Vec4<T>(
             v.x * r0.x + v.y * r0.y + v.z * r0.z + v.w * r0.w,
             v.x * r1.x + v.y * r1.y + v.z * r1.z + v.w * r1.w,
@@ -206,7 +247,7 @@ struct Mat4x4 {
     }
 
     Mat4x4<T> operator *(T v) const {
-        return Mat4xr<T>(
+        return Mat4x4<T>(
             r0 * v,
             r1 * v,
             r2 * v,
@@ -250,7 +291,7 @@ struct Mat4x4 {
         auto right = up.Cross(lookat).Normalize(); //r = t x g = -g x t
         auto nup = lookat.Cross(right).Normalize(); //u = g x r = r x -g
 
-        return Matrix4x4(
+        return Mat4x4<T>(
             right.x,right.y,right.z,-pos.Dot(right),
             nup.x,nup.y,nup.z,-pos.Dot(nup),
             lookat.x,lookat.y,lookat.z,-pos.Dot(lookat),
@@ -275,6 +316,75 @@ const Mat4x4<T> Mat4x4<T>::zero(
     (T)0, (T)0, (T)0, (T)0
 );
 
+//batch transforms for arrays of vertices: in and out advance by their strides in bytes, so the
+//attributes can be read from and written to arrays of structs. the matrix is split into its columns
+//once for the whole batch, the results match the single vector functions
+
+//out = m * in
+inline void TransformPoints(const Mat4x4<float>& m, const Vec4<float>* in, size_t in_stride, Vec4<float>* out, size_t out_stride, int count) {
+#if RENDERTOY_SSE2
+    __m128 c0 = m.r0.simd(), c1 = m.r1.simd(), c2 = m.r2.simd(), c3 = m.r3.simd();
+    _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+#endif
+    const char* src = reinterpret_cast<const char*>(in);
+    char* dst = reinterpret_cast<char*>(out);
+    for (int i = 0; i < count; ++i, src += in_stride, dst += out_stride) {
+        const Vec4<float>& v = *reinterpret_cast<const Vec4<float>*>(src);
+#if RENDERTOY_SSE2
+        __m128 res = _mm_mul_ps(c0, _mm_set1_ps(v.x));
+        res = _mm_add_ps(res, _mm_mul_ps(c1, _mm_set1_ps(v.y)));
+        res = _mm_add_ps(res, _mm_mul_ps(c2, _mm_set1_ps(v.z)));
+        res = _mm_add_ps(res, _mm_mul_ps(c3, _mm_set1_ps(v.w)));
+        *reinterpret_cast<Vec4<float>*>(dst) = Vec4<float>(res);
+#else
+        *reinterpret_cast<Vec4<float>*>(dst) = m * v;
+#endif
+    }
+}
+
+//out = m.MultiplyPoint3X4(in.xyz), the w of the input points is not read
+inline void TransformPoints(const Mat4x4<float>& m, const Vec4<float>* in, size_t in_stride, Vec3<float>* out, size_t out_stride, int count) {
+#if RENDERTOY_SSE2
+    __m128 c0 = m.r0.simd(), c1 = m.r1.simd(), c2 = m.r2.simd(), c3 = m.r3.simd();
+    _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+#endif
+    const char* src = reinterpret_cast<const char*>(in);
+    char* dst = reinterpret_cast<char*>(out);
+    for (int i = 0; i < count; ++i, src += in_stride, dst += out_stride) {
+        const Vec4<float>& v = *reinterpret_cast<const Vec4<float>*>(src);
+#if RENDERTOY_SSE2
+        __m128 res = _mm_mul_ps(c0, _mm_set1_ps(v.x));
+        res = _mm_add_ps(res, _mm_mul_ps(c1, _mm_set1_ps(v.y)));
+        res = _mm_add_ps(res, _mm_mul_ps(c2, _mm_set1_ps(v.z)));
+        Vec4<float> p(_mm_add_ps(res, c3));
+        *reinterpret_cast<Vec3<float>*>(dst) = Vec3<float>(p.x, p.y, p.z);
+#else
+        *reinterpret_cast<Vec3<float>*>(dst) = m.MultiplyPoint3X4(Vec3<float>(v.x, v.y, v.z));
+#endif
+    }
+}
+
+//out = m.MultiplyVector(in)
+inline void TransformVectors(const Mat4x4<float>& m, const Vec3<float>* in, size_t in_stride, Vec3<float>* out, size_t out_stride, int count) {
+#if RENDERTOY_SSE2
+    __m128 c0 = m.r0.simd(), c1 = m.r1.simd(), c2 = m.r2.simd(), c3 = m.r3.simd();
+    _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+#endif
+    const char* src = reinterpret_cast<const char*>(in);
+    char* dst = reinterpret_cast<char*>(out);
+    for (int i = 0; i < count; ++i, src += in_stride, dst += out_stride) {
+        const Vec3<float>& v = *reinterpret_cast<const Vec3<float>*>(src);
+#if RENDERTOY_SSE2
+        __m128 res = _mm_mul_ps(c0, _mm_set1_ps(v.x));
+        res = _mm_add_ps(res, _mm_mul_ps(c1, _mm_set1_ps(v.y)));
+        Vec4<float> p(_mm_add_ps(res, _mm_mul_ps(c2, _mm_set1_ps(v.z))));
+        *reinterpret_cast<Vec3<float>*>(dst) = Vec3<float>(p.x, p.y, p.z);
+#else
+        *reinterpret_cast<Vec3<float>*>(dst) = m.MultiplyVector(v);
+#endif
+    }
+}
+
 }
 
 using Matrix4x4 = math::Mat4x4<float>;
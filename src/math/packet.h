@@ -0,0 +1,177 @@
+#pragma once
+
+#include <math.h>
+#include "simd.h"
+#include "vec3.h"
+
+namespace rendertoy {
+namespace math {
+
+//four floats shaded together, one lane per fragment (structure of arrays).
+//SSE2 where available, a plain loop over the lanes otherwise
+struct Floatx4 {
+    static constexpr int kLanes = 4;
+
+#if RENDERTOY_SSE2
+    __m128 v;
+
+    Floatx4() : v(_mm_setzero_ps()) {}
+    Floatx4(float f) : v(_mm_set1_ps(f)) {}
+    explicit Floatx4(__m128 m) : v(m) {}
+
+    static Floatx4 Load(const float* p) { return Floatx4(_mm_loadu_ps(p)); }
+    void Store(float* p) const { _mm_storeu_ps(p, v); }
+
+    Floatx4 operator +(const Floatx4& o) const { return Floatx4(_mm_add_ps(v, o.v)); }
+    Floatx4 operator -(const Floatx4& o) const { return Floatx4(_mm_sub_ps(v, o.v)); }
+    Floatx4 operator *(const Floatx4& o) const { return Floatx4(_mm_mul_ps(v, o.v)); }
+    Floatx4 operator /(const Floatx4& o) const { return Floatx4(_mm_div_ps(v, o.v)); }
+    Floatx4 operator -() const { return Floatx4(_mm_sub_ps(_mm_setzero_ps(), v)); }
+
+    //lane masks are all bits set or all clear, as produced by the comparisons
+    Floatx4 operator <(const Floatx4& o) const { return Floatx4(_mm_cmplt_ps(v, o.v)); }
+    Floatx4 operator >(const Floatx4& o) const { return Floatx4(_mm_cmpgt_ps(v, o.v)); }
+    Floatx4 operator &(const Floatx4& o) const { return Floatx4(_mm_and_ps(v, o.v)); }
+    Floatx4 operator |(const Floatx4& o) const { return Floatx4(_mm_or_ps(v, o.v)); }
+
+    //bit i is set if lane i of the mask is
+    int MoveMask() const { return _mm_movemask_ps(v); }
+
+    static Floatx4 Min(const Floatx4& a, const Floatx4& b) { return Floatx4(_mm_min_ps(a.v, b.v)); }
+    static Floatx4 Max(const Floatx4& a, const Floatx4& b) { return Floatx4(_mm_max_ps(a.v, b.v)); }
+    static Floatx4 Sqrt(const Floatx4& a) { return Floatx4(_mm_sqrt_ps(a.v)); }
+    //a where the mask is set, b elsewhere
+    static Floatx4 Select(const Floatx4& mask, const Floatx4& a, const Floatx4& b) {
+        return Floatx4(_mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)));
+    }
+    //mask with the first count lanes set
+    static Floatx4 FirstLanes(int count) {
+        __m128i lane = _mm_set_epi32(3, 2, 1, 0);
+        return Floatx4(_mm_castsi128_ps(_mm_cmplt_epi32(lane, _mm_set1_epi32(count))));
+    }
+#else
+    float v[kLanes];
+
+    Floatx4() : v{ 0.0f, 0.0f, 0.0f, 0.0f } {}
+    Floatx4(float f) : v{ f, f, f, f } {}
+
+    static Floatx4 Load(const float* p) { Floatx4 r; for (int i = 0; i < kLanes; ++i) r.v[i] = p[i]; return r; }
+    void Store(float* p) const { for (int i = 0; i < kLanes; ++i) p[i] = v[i]; }
+
+    template <typename F>
+    static Floatx4 Map(const Floatx4& a, const Floatx4& b, F f) {
+        Floatx4 r;
+        for (int i = 0; i < kLanes; ++i) r.v[i] = f(a.v[i], b.v[i]);
+        return r;
+    }
+    static float MaskLane(bool on) { return on ? -1.0f : 0.0f; } //sign bit marks a set lane
+
+    Floatx4 operator +(const Floatx4& o) const { return Map(*this, o, [](float a, float b) { return a + b; }); }
+    Floatx4 operator -(const Floatx4& o) const { return Map(*this, o, [](float a, float b) { return a - b; }); }
+    Floatx4 operator *(const Floatx4& o) const { return Map(*this, o, [](float a, float b) { return a * b; }); }
+    Floatx4 operator /(const Floatx4& o) const { return Map(*this, o, [](float a, float b) { return a / b; }); }
+    Floatx4 operator -() const { return Floatx4(0.0f) - *this; }
+
+    Floatx4 operator <(const Floatx4& o) const { return Map(*this, o, [](float a, float b) { return MaskLane(a < b); }); }
+    Floatx4 operator >(const Floatx4& o) const { return Map(*this, o, [](float a, float b) { return MaskLane(a > b); }); }
+    Floatx4 operator &(const Floatx4& o) const { return Map(*this, o, [](float a, float b) { return MaskLane(a < 0.0f && b < 0.0f); }); }
+    Floatx4 operator |(const Floatx4& o) const { return Map(*this, o, [](float a, float b) { return MaskLane(a < 0.0f || b < 0.0f); }); }
+
+    int MoveMask() const {
+        int mask = 0;
+        for (int i = 0; i < kLanes; ++i) mask |= (v[i] < 0.0f) << i;
+        return mask;
+    }
+
+    static Floatx4 Min(const Floatx4& a, const Floatx4& b) { return Map(a, b, [](float x, float y) { return x < y ? x : y; }); }
+    static Floatx4 Max(const Floatx4& a, const Floatx4& b) { return Map(a, b, [](float x, float y) { return x > y ? x : y; }); }
+    static Floatx4 Sqrt(const Floatx4& a) { return Map(a, a, [](float x, float) { return sqrtf(x); }); }
+    static Floatx4 Select(const Floatx4& mask, const Floatx4& a, const Floatx4& b) {
+        Floatx4 r;
+        for (int i = 0; i < kLanes; ++i) r.v[i] = mask.v[i] < 0.0f ? a.v[i] : b.v[i];
+        return r;
+    }
+    static Floatx4 FirstLanes(int count) {
+        Floatx4 r;
+        for (int i = 0; i < kLanes; ++i) r.v[i] = MaskLane(i < count);
+        return r;
+    }
+#endif
+
+    //lane i of the packet, slow, for the scalar parts of a shader
+    float operator [](int i) const {
+        float lanes[kLanes];
+        Store(lanes);
+        return lanes[i];
+    }
+
+    Floatx4& operator +=(const Floatx4& o) { return *this = *this + o; }
+    Floatx4& operator *=(const Floatx4& o) { return *this = *this * o; }
+
+    static Floatx4 Clamp(const Floatx4& a, const Floatx4& min, const Floatx4& max) { return Min(Max(a, min), max); }
+    static Floatx4 Saturate(const Floatx4& a) { return Clamp(a, 0.0f, 1.0f); }
+};
+
+inline Floatx4 operator +(float a, const Floatx4& b) { return Floatx4(a) + b; }
+inline Floatx4 operator -(float a, const Floatx4& b) { return Floatx4(a) - b; }
+inline Floatx4 operator *(float a, const Floatx4& b) { return Floatx4(a) * b; }
+
+//four Vec3f, one per lane
+struct Vec3x4 {
+    Floatx4 x;
+    Floatx4 y;
+    Floatx4 z;
+
+    Vec3x4() {}
+    Vec3x4(const Floatx4& x_, const Floatx4& y_, const Floatx4& z_) : x(x_), y(y_), z(z_) {}
+    //the same vector in every lane
+    Vec3x4(const Vec3<float>& v) : x(v.x), y(v.y), z(v.z) {}
+
+    //lanes past count are zero
+    static Vec3x4 Gather(const Vec3<float>* v, int count) {
+        float xs[Floatx4::kLanes] = {}, ys[Floatx4::kLanes] = {}, zs[Floatx4::kLanes] = {};
+        for (int i = 0; i < count; ++i) {
+            xs[i] = v[i].x;
+            ys[i] = v[i].y;
+            zs[i] = v[i].z;
+        }
+        return Vec3x4(Floatx4::Load(xs), Floatx4::Load(ys), Floatx4::Load(zs));
+    }
+
+    void Scatter(Vec3<float>* v, int count) const {
+        float xs[Floatx4::kLanes], ys[Floatx4::kLanes], zs[Floatx4::kLanes];
+        x.Store(xs);
+        y.Store(ys);
+        z.Store(zs);
+        for (int i = 0; i < count; ++i) {
+            v[i] = Vec3<float>(xs[i], ys[i], zs[i]);
+        }
+    }
+
+    Vec3<float> Lane(int i) const { return Vec3<float>(x[i], y[i], z[i]); }
+
+    Floatx4 Dot(const Vec3x4& o) const { return x * o.x + y * o.y + z * o.z; }
+    Floatx4 MagnitudeSq() const { return Dot(*this); }
+    Vec3x4 Normalize() const {
+        Floatx4 inv = Floatx4(1.0f) / Floatx4::Sqrt(MagnitudeSq());
+        return *this * inv;
+    }
+
+    Vec3x4 operator +(const Vec3x4& o) const { return Vec3x4(x + o.x, y + o.y, z + o.z); }
+    Vec3x4 operator -(const Vec3x4& o) const { return Vec3x4(x - o.x, y - o.y, z - o.z); }
+    Vec3x4 operator *(const Vec3x4& o) const { return Vec3x4(x * o.x, y * o.y, z * o.z); }
+    Vec3x4 operator *(const Floatx4& s) const { return Vec3x4(x * s, y * s, z * s); }
+    Vec3x4 operator /(const Floatx4& s) const { return *this * (Floatx4(1.0f) / s); }
+    Vec3x4 operator -() const { return Vec3x4(-x, -y, -z); }
+    Vec3x4& operator +=(const Vec3x4& o) { return *this = *this + o; }
+
+    static Vec3x4 Select(const Floatx4& mask, const Vec3x4& a, const Vec3x4& b) {
+        return Vec3x4(Floatx4::Select(mask, a.x, b.x), Floatx4::Select(mask, a.y, b.y), Floatx4::Select(mask, a.z, b.z));
+    }
+    static Vec3x4 Lerp(const Vec3x4& a, const Vec3x4& b, const Floatx4& t) { return a * (1.0f - t) + b * t; }
+};
+
+inline Vec3x4 operator -(float a, const Vec3x4& b) { return Vec3x4(a - b.x, a - b.y, a - b.z); }
+
+}
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+//SSE2 is part of every x86-64 target, other targets use the scalar code paths
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RENDERTOY_SSE2 1
+#include <emmintrin.h>
+#endif
@@ -1,14 +1,17 @@
 #pragma once
 
 #include <assert.h>
+#include <type_traits>
 #include "util.h"
+#include "simd.h"
 #include "vec3.h"
 
 namespace rendertoy {
 namespace math {
 
+//aligned to its size, so a Vec4f is loaded into an SSE register with one aligned load
 template<typename T>
-struct Vec4 {
+struct alignas(4 * sizeof(T)) Vec4 {
     using value_type = T;
 
     static constexpr int kSize = 4;
@@ -22,6 +25,14 @@ struct Vec4 {
         struct { T r, g, b, a; };
     };
 
+#if RENDERTOY_SSE2
+    //float vectors take the SSE paths below, with the same lane order and rounding as the scalar ones
+    static constexpr bool kSimd = std::is_same<T, float>::value;
+
+    explicit Vec4(__m128 v) { _mm_store_ps(reinterpret_cast<float*>(value), v); }
+    __m128 simd() const { return _mm_load_ps(reinterpret_cast<const float*>(value)); }
+#endif
+
     constexpr Vec4() : x(0), y(0), z(0), w(0) {}
 
     constexpr Vec4(T x_, T y_, T z_, T w_) : x(x_), y(y_), z(z_), w(w_) {
@@ -91,7 +102,7 @@ struct Vec4 {
     }
 
     T MagnitudeSq() const {
-        return x * x + y * y + z * z + w * w;
+        return Dot(*this);
     }
 
     T Magnitude() const {
@@ -99,6 +110,13 @@ struct Vec4 {
     }
 
     T Dot(const Vec4<T>& v) const {
+#if RENDERTOY_SSE2
+        if constexpr (kSimd) {
+            //multiply in parallel, add in the scalar order
+            Vec4<T> m(_mm_mul_ps(simd(), v.simd()));
+            return m.x + m.y + m.z + m.w;
+        }
+#endif
         return x * v.x + y * v.y + z * v.z + w * v.w;
     }
 
@@ -148,6 +166,9 @@ struct Vec4 {
     }
 
     Vec4<T> operator +(const Vec4<T>& v) const {
+#if RENDERTOY_SSE2
+        if constexpr (kSimd) return Vec4<T>(_mm_add_ps(simd(), v.simd()));
+#endif
         return Vec4<T>(x + v.x, y + v.y, z + v.z, w + v.w);
     }
 
@@ -164,6 +185,9 @@ struct Vec4 {
     }
 
     Vec4<T>& operator +=(const Vec4<T>& v) {
+#if RENDERTOY_SSE2
+        if constexpr (kSimd) return *this = *this + v;
+#endif
         x += v.x;
         y += v.y;
         z += v.z;
@@ -172,6 +196,9 @@ struct Vec4 {
     }
 
     Vec4<T> operator -(const Vec4<T>& v) const {
+#if RENDERTOY_SSE2
+        if constexpr (kSimd) return Vec4<T>(_mm_sub_ps(simd(), v.simd()));
+#endif
         return Vec4<T>(x - v.x, y - v.y, z - v.z, w - v.w);
     }
 
@@ -192,6 +219,9 @@ struct Vec4 {
     }
 
     Vec4<T>& operator -=(const Vec4<T>& v) {
+#if RENDERTOY_SSE2
+        if constexpr (kSimd) return *this = *this - v;
+#endif
         x -= v.x;
         y -= v.y;
         z -= v.z;
@@ -200,14 +230,23 @@ struct Vec4 {
     }
 
     Vec4<T> operator *(const Vec4<T>& v) const {
+#if RENDERTOY_SSE2
+        if constexpr (kSimd) return Vec4<T>(_mm_mul_ps(simd(), v.simd()));
+#endif
         return Vec4<T>(x * v.x, y * v.y, z * v.z, w * v.w);
     }
 
     Vec4<T> operator *(T v) const {
+#if RENDERTOY_SSE2
+        if constexpr (kSimd) return Vec4<T>(_mm_mul_ps(simd(), _mm_set1_ps(v)));
+#endif
         return Vec4<T>(x * v, y * v, z * v, w * v);
     }
 
     Vec4<T>& operator *=(T v) {
+#if RENDERTOY_SSE2
+        if constexpr (kSimd) return *this = *this * v;
+#endif
         x *= v;
         y *= v;
         z *= v;
@@ -216,6 +255,9 @@ struct Vec4 {
     }
 
     Vec4<T>& operator *=(const Vec4<T>& v) {
+#if RENDERTOY_SSE2
+        if constexpr (kSimd) return *this = *this * v;
+#endif
         x *= v.x;
         y *= v.y;
         z *= v.z;
@@ -258,10 +300,16 @@ struct Vec4 {
     }
 
     static Vec4<T> Min(const Vec4<T>& left, const Vec4<T>& right) {
+#if RENDERTOY_SSE2
+        if constexpr (kSimd) return Vec4<T>(_mm_min_ps(right.simd(), left.simd())); //picks left on ties like math::Min
+#endif
         return Vec4<T>(math::Min(left.x, right.x), math::Min(left.y, right.y), math::Min(left.z, right.z), math::Min(left.w, right.w));
     }
 
     static Vec4<T> Max(const Vec4<T>& left, const Vec4<T>& right) {
+#if RENDERTOY_SSE2
+        if constexpr (kSimd) return Vec4<T>(_mm_max_ps(left.simd(), right.simd()));
+#endif
         return Vec4<T>(math::Max(left.x, right.x), math::Max(left.y, right.y), math::Max(left.z, right.z), math::Max(left.w, right.w));
     }
     
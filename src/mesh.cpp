@@ -1,4 +1,6 @@
 #include "mesh.h"
+#include <map>
+#include <array>
 #include "3rdparty/obj_loader.h"
 
 namespace rendertoy {
@@ -73,20 +75,34 @@ Mesh::Mesh(const char* filename) : material_(nullptr) {
     bool loadout = loader.LoadFile(filename);
     
     for(auto& mesh : loader.LoadedMeshes) {
-        for (auto& vertex : mesh.Vertices) {
-            AddVertex(Vec4f(vertex.Position.X, vertex.Position.Y, -vertex.Position.Z, 1.0f), 
-                Vec4f(0, 0, 0, 255.0f),
-                Vec3f(vertex.Normal.X, vertex.Normal.Y, -vertex.Normal.Z), 
-                Vec2f(vertex.TextureCoordinate.X,
-                    vertex.TextureCoordinate.Y < 0.0f ? 
-                    -vertex.TextureCoordinate.Y : vertex.TextureCoordinate.Y)
-            );
+        //the loader emits one vertex per face corner, identical corners are welded
+        //so a vertex shared by several triangles is shaded once
+        std::map<std::array<float, 8>, uint32_t> welded;
+        std::vector<uint32_t> remap(mesh.Vertices.size());
+        for (int i = 0; i < mesh.Vertices.size(); ++i) {
+            auto& vertex = mesh.Vertices[i];
+            std::array<float, 8> key = {
+                vertex.Position.X, vertex.Position.Y, vertex.Position.Z,
+                vertex.Normal.X, vertex.Normal.Y, vertex.Normal.Z,
+                vertex.TextureCoordinate.X, vertex.TextureCoordinate.Y
+            };
+            auto result = welded.emplace(key, (uint32_t)vertices_.size());
+            if (result.second) {
+                AddVertex(Vec4f(vertex.Position.X, vertex.Position.Y, -vertex.Position.Z, 1.0f), 
+                    Vec4f(0, 0, 0, 255.0f),
+                    Vec3f(vertex.Normal.X, vertex.Normal.Y, -vertex.Normal.Z), 
+                    Vec2f(vertex.TextureCoordinate.X,
+                        vertex.TextureCoordinate.Y < 0.0f ? 
+                        -vertex.TextureCoordinate.Y : vertex.TextureCoordinate.Y)
+                );
+            }
+            remap[i] = result.first->second;
         }
 
         for (int i = 0; i < mesh.Indices.size(); i+=3) {
-            auto i0 = mesh.Indices[i+2];
-            auto i1 = mesh.Indices[i+1];
-            auto i2 = mesh.Indices[i];
+            auto i0 = remap[mesh.Indices[i+2]];
+            auto i1 = remap[mesh.Indices[i+1]];
+            auto i2 = remap[mesh.Indices[i]];
 
             AddTriangle(i0, i1, i2);
 
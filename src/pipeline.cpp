@@ -10,7 +10,7 @@
 
 namespace rendertoy {
 
-Pipeline::Pipeline() : cast_shadow_(false), render_texture_(nullptr), render_type_(Primitive::kTriangle) {
+Pipeline::Pipeline() : cast_shadow_(false), depth_prepass_(false), shading_mode_(ShadingMode::kForward), resolve_filter_(ResolveFilter::kBox), render_texture_(nullptr), render_type_(Primitive::kTriangle) {
     default_material_ = new VertLitMaterial();
 }
 
@@ -53,6 +53,22 @@ void Pipeline::SetShadow(bool on) {
     cast_shadow_ = on;
 }
 
+void Pipeline::SetDepthPrepass(bool on) {
+    depth_prepass_ = on;
+}
+
+void Pipeline::SetShadingMode(ShadingMode mode) {
+    shading_mode_ = mode;
+}
+
+void Pipeline::SetResolveFilter(ResolveFilter filter) {
+    resolve_filter_ = filter;
+}
+
+void Pipeline::SetBackend(RasterBackend backend, int thread_count) {
+    Graphics::Instance()->SetBackend(backend, thread_count);
+}
+
 void Pipeline::CastShadow(Uniform& u) {
     float width = 7.0f;
     float height = 7.0f;
@@ -72,6 +88,10 @@ void Pipeline::CastShadow(Uniform& u) {
     for (auto& model : models_) {
         DrawModel(model, u, ShadowShader::Instance());
     }
+
+    //shaders sample the raw depth samples of the shadow map
+    graphic->Flush();
+    shadow_texture_->DecompressDepth();
 }
 
 void Pipeline::RenderScene(Uniform& u, Camera& camera, Primitive type) {
@@ -91,10 +111,34 @@ void Pipeline::RenderScene(Uniform& u, Camera& camera, Primitive type) {
     graphic->SetRenderTarget(render_texture_);
     graphic->SetRenderType(type);
 
+    //depth only first, then every visible sample is shaded once by the equal test
+    if (depth_prepass_) {
+        for (auto& model : models_) {
+            DrawModel(model, u, ShadowShader::Instance(), true);
+        }
+        graphic->SetDepthFunc(DepthFunc::kEqual);
+    }
+
+    if (shading_mode_ == ShadingMode::kDeferred) {
+        gbuffer_.Resize(width, height);
+        gbuffer_.Clear();
+        graphic->SetGBuffer(&gbuffer_);
+    } else if (shading_mode_ == ShadingMode::kVisibility) {
+        graphic->BeginVisibilityBuffer();
+    }
+
     for (auto& model : models_) {
         DrawModel(model, u);
     }
 
+    if (shading_mode_ == ShadingMode::kDeferred) {
+        graphic->SetGBuffer(nullptr);
+        graphic->DrawGBuffer(gbuffer_);
+    } else if (shading_mode_ == ShadingMode::kVisibility) {
+        graphic->ResolveVisibilityBuffer();
+    }
+
+    graphic->SetDepthFunc(DepthFunc::kLess);
     DrawModel(sky_box_, u);
 }
 
@@ -121,15 +165,14 @@ void Pipeline::Render(Camera& camera, Primitive type) {
     RenderScene(u, camera, type);
 
     DrawModel(sky_box_, u);
+
+    graphic->Resolve(resolve_filter_);
 }
 
-void Pipeline::DrawModel(const Model& model, Uniform& u, Shader* replace_shader) {
+void Pipeline::DrawModel(const Model& model, Uniform& u, Shader* replace_shader, bool keep_cull) {
     Graphics* graphic = Graphics::Instance();
     u.model = model.model_transform();
     for (auto& mesh : model.meshes()) {
-        auto& vertices = mesh.vertices();
-        auto& triangles = mesh.triangles();
-
         u.mvp = u.vp * u.model;
         if (u.shadow_light_) {
             u.shadow_light_->mvp = u.shadow_light_->vp_matrix * u.model;
@@ -143,27 +186,20 @@ void Pipeline::DrawModel(const Model& model, Uniform& u, Shader* replace_shader)
         if (replace_shader) {
             replace_shader->uniform(&u);
             graphic->SetShader(replace_shader);
-
-            for (auto& tri : triangles) {
-                graphic->DrawTriangle(
-                    vertices[tri[0]],
-                    vertices[tri[1]],
-                    vertices[tri[2]]
-                );
+            if (keep_cull && !u.mat->pass().empty()) {
+                graphic->SetCullMode(u.mat->pass()[0]->cull());
             }
+
+            graphic->DrawIndexed(mesh.vertices(), mesh.triangles());
+            graphic->Flush();
         } else {
             for (Shader* shader : u.mat->pass()) {
                 shader->uniform(&u);
 
                 graphic->SetShader(shader);
 
-                for (auto& tri : triangles) {
-                    graphic->DrawTriangle(
-                        vertices[tri[0]],
-                        vertices[tri[1]],
-                        vertices[tri[2]]
-                    );
-                }
+                graphic->DrawIndexed(mesh.vertices(), mesh.triangles());
+                graphic->Flush();
             }
         }
     }
@@ -10,6 +10,7 @@
 #include "light.h"
 #include "material/material.h"
 #include "texture3D.h"
+#include "gbuffer.h"
 
 namespace rendertoy {
 
@@ -32,6 +33,13 @@ public:
     void AddLight(const Light& light);
     void SetSkybox(Model&& skybox);
     void SetShadow(bool on);
+    //render opaque models depth only before shading them with an equal depth test
+    void SetDepthPrepass(bool on);
+    //how the opaque models are shaded, see ShadingMode
+    void SetShadingMode(ShadingMode mode);
+    //filter turning the samples of the render target into the resolved colors at the end of Render
+    void SetResolveFilter(ResolveFilter filter);
+    void SetBackend(RasterBackend backend, int thread_count = 0);
 
     void Render(Camera& camera, Primitive type);
     
@@ -45,7 +53,8 @@ private:
     void CastShadow(Uniform& u);
     void RenderScene(Uniform& u, Camera& camera, Primitive type);
 
-    void DrawModel(const Model& model, Uniform& u, Shader* replace_shader=nullptr);
+    //keep_cull draws replace_shader with the cull mode of the material instead of its own
+    void DrawModel(const Model& model, Uniform& u, Shader* replace_shader=nullptr, bool keep_cull=false);
 
     std::vector<Model> models_;
     std::vector<Light> lights_;
@@ -54,6 +63,10 @@ private:
     std::vector<Texture3D*> texture3Ds_;
 
     bool cast_shadow_;
+    bool depth_prepass_;
+    ShadingMode shading_mode_;
+    ResolveFilter resolve_filter_;
+    GBuffer gbuffer_;
     Model sky_box_;
     Material* default_material_;
     RenderTexture* render_texture_;
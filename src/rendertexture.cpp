@@ -1,16 +1,29 @@
 #include "rendertexture.h"
 #include  <cmath>
+#include <limits>
+#include <algorithm>
 #include "common/color.h"
+#include "common/thread_pool.h"
 
 namespace rendertoy {
 
 RenderTexture::RenderTexture(int w, int h, MSAALevel lvl) : 
     width_(w), 
-    height_(h)
+    height_(h),
+    tiled_(false),
+    tile_cols_(0),
+    color_slots_(1),
+    expandable_(true),
+    block_cols_(0),
+    block_rows_(0)
 {
     msaa(lvl);
 }
 
+RenderTexture::~RenderTexture() {
+    ReleaseExpanded();
+}
+
 void RenderTexture::msaa(MSAALevel lvl) {
     msaa_ = lvl;
     sample_exp_ = static_cast<int>(lvl);
@@ -19,12 +32,209 @@ void RenderTexture::msaa(MSAALevel lvl) {
         msaa_pattern_ = kMSAAPattern2;
     } else if (msaa_ == MSAALevel::k4x) {
         msaa_pattern_ = kMSAAPattern4;
+    } else if (msaa_ == MSAALevel::kEQAA8x) {
+        msaa_pattern_ = kMSAAPattern8;
     } else {
         msaa_pattern_ = kMSAAPattern0;
     }
+    expandable_ = msaa_ != MSAALevel::kEQAA8x;
+
+    ResizeBuffers();
+    ResizeHiZ();
+}
+
+void RenderTexture::tiled(bool on) {
+    tiled_ = on;
+    ResizeBuffers();
+}
+
+void RenderTexture::ResizeBuffers() {
+    int w = width_;
+    int h = height_;
+    if (tiled_) {
+        //whole tiles, the padding is never read back
+        int tile = 1 << kTileShift;
+        tile_cols_ = (width_ + tile - 1) >> kTileShift;
+        w = tile_cols_ << kTileShift;
+        h = ((height_ + tile - 1) >> kTileShift) << kTileShift;
+    }
+
+    color_slots_ = sample_size_ > 1 ? kColorSlots : 1;
+    color_buffer_.Resize(w * color_slots_, h);
+    //fragment masks, expanded samples and the resolve only exist for several samples
+    if (sample_size_ > 1) {
+        fragment_mask_.Resize(w, h);
+        resolved_buffer_.Resize(width_, height_);
+    } else {
+        Buffer<uint16_t>().Swap(fragment_mask_);
+        Buffer<Vec4f>().Swap(resolved_buffer_);
+    }
+    depth_buffer_.Resize(w * sample_size_, h);
+    //dropped until the next id clear allocates it, most targets never hold a visibility buffer
+    Buffer<uint32_t>().Swap(id_buffer_);
+
+    ReleaseExpanded();
+    int block = 1 << kTileShift;
+    block_cols_ = (width_ + block - 1) >> kTileShift;
+    block_rows_ = (height_ + block - 1) >> kTileShift;
+    if (sample_size_ > 1) {
+        expanded_.reset(new std::atomic<Vec4f*>[block_cols_ * block_rows_]);
+        for (int i = 0; i < block_cols_ * block_rows_; ++i) {
+            expanded_[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
 
-    color_buffer_.Resize(width_ * sample_size_, height_);
-    depth_buffer_.Resize(width_ * sample_size_, height_);
+    //raw until the next clear, like the rest of the storage
+    depth_tiles_.Resize(block_cols_, block_rows_);
+    for (auto& tile : depth_tiles_.data()) {
+        tile.planes = 0;
+    }
+}
+
+void RenderTexture::ReleaseExpanded() {
+    if (!expanded_) return;
+
+    for (int i = 0; i < block_cols_ * block_rows_; ++i) {
+        delete[] expanded_[i].load(std::memory_order_relaxed);
+    }
+    expanded_.reset();
+}
+
+Vec4f* RenderTexture::ExpandedSamples(int x, int y) {
+    std::atomic<Vec4f*>& block = expanded_[(y >> kTileShift) * block_cols_ + (x >> kTileShift)];
+    Vec4f* samples = block.load(std::memory_order_acquire);
+    if (!samples) {
+        //pixels of one block can be shaded on different threads, the first one to expand allocates
+        Vec4f* storage = new Vec4f[(size_t)1 << (kTileShift * 2 + sample_exp_)];
+        if (block.compare_exchange_strong(samples, storage, std::memory_order_acq_rel)) {
+            samples = storage;
+        } else {
+            delete[] storage;
+        }
+    }
+
+    int mask = (1 << kTileShift) - 1;
+    return samples + ((((y & mask) << kTileShift) + (x & mask)) << sample_exp_);
+}
+
+const Vec4f* RenderTexture::ExpandedSamples(int x, int y) const {
+    const Vec4f* samples = expanded_[(y >> kTileShift) * block_cols_ + (x >> kTileShift)].load(std::memory_order_acquire);
+    assert(samples);
+    int mask = (1 << kTileShift) - 1;
+    return samples + ((((y & mask) << kTileShift) + (x & mask)) << sample_exp_);
+}
+
+void RenderTexture::ResizeHiZ() {
+    int w = width_;
+    int h = height_;
+    for (auto& level : hiz_) {
+        int block = (1 << kHiZShift) - 1;
+        w = (w + block) >> kHiZShift;
+        h = (h + block) >> kHiZShift;
+        level.max_depth.Resize(w, h);
+        level.min_depth.Resize(w, h);
+        level.dirty.Resize(w, h);
+    }
+}
+
+void RenderTexture::UpdateHiZ(int x, int y, float depth) {
+    for (auto& level : hiz_) {
+        x >>= kHiZShift;
+        y >>= kHiZShift;
+        level.dirty.Set(x, y, 1);
+        if (depth < level.min_depth.Get(x, y)) {
+            level.min_depth.Set(x, y, depth);
+        }
+    }
+}
+
+float RenderTexture::GetMaxDepth(int level, int bx, int by) {
+    HiZLevel& hiz = hiz_[level];
+    if (!hiz.dirty.Get(bx, by)) {
+        return hiz.max_depth.Get(bx, by);
+    }
+
+    float max_depth = -std::numeric_limits<float>::infinity();
+    int size = 1 << kHiZShift;
+    if (level == 0 && depth_tiles_.data()[by * block_cols_ + bx].planes != 0) {
+        //compressed blocks are bounded by their planes, no samples are read
+        max_depth = TileMaxDepth(depth_tiles_.data()[by * block_cols_ + bx], bx, by);
+    } else if (level == 0) {
+        int x_end = math::Min((bx + 1) * size, width_);
+        int y_end = math::Min((by + 1) * size, height_);
+        for (int y = by * size; y < y_end; ++y) {
+            const float* row = depth_buffer_.data().data() + Index(bx * size, y, 0);
+            int count = (x_end - bx * size) << sample_exp_;
+            for (int i = 0; i < count; ++i) {
+                max_depth = math::Max(max_depth, row[i]);
+            }
+        }
+    } else {
+        const HiZLevel& below = hiz_[level - 1];
+        int x_end = math::Min((bx + 1) * size, below.max_depth.width());
+        int y_end = math::Min((by + 1) * size, below.max_depth.height());
+        for (int y = by * size; y < y_end; ++y) {
+            for (int x = bx * size; x < x_end; ++x) {
+                max_depth = math::Max(max_depth, GetMaxDepth(level - 1, x, y));
+            }
+        }
+    }
+
+    hiz.max_depth.Set(bx, by, max_depth);
+    hiz.dirty.Set(bx, by, 0);
+    return max_depth;
+}
+
+float RenderTexture::GetMinDepth(int level, int bx, int by) const {
+    return hiz_[level].min_depth.Get(bx, by);
+}
+
+float RenderTexture::TileMaxDepth(const DepthTile& tile, int bx, int by) const {
+    //a plane is largest at a corner of the block, samples are at most half a pixel from their pixel center
+    int size = 1 << kTileShift;
+    int x[2] = { bx * size, math::Min((bx + 1) * size, width_) - 1 };
+    int y[2] = { by * size, math::Min((by + 1) * size, height_) - 1 };
+    //At rounds relative to its largest term rather than the result, so with cancellation a sample and a corner
+    //can round several ulps of the result apart. each corner is padded by a few ulps of the summed terms
+    const float tolerance = 4.0f * std::numeric_limits<float>::epsilon();
+    float max_depth = -std::numeric_limits<float>::infinity();
+    for (int p = 0; p < tile.planes; ++p) {
+        const DepthPlane& plane = tile.plane[p];
+        for (int corner = 0; corner < 4; ++corner) {
+            int cx = corner & 1;
+            int cy = corner >> 1;
+            Vec2f offset(cx ? 0.5f : -0.5f, cy ? 0.5f : -0.5f);
+            float terms = std::abs(plane.z0) + std::abs(plane.dzdx * ((float)(x[cx] - plane.x0) + offset.x)) +
+                std::abs(plane.dzdy * ((float)(y[cy] - plane.y0) + offset.y));
+            max_depth = math::Max(max_depth, plane.At(x[cx], y[cy], offset) + terms * tolerance);
+        }
+    }
+    return max_depth;
+}
+
+void RenderTexture::DecompressTile(int bx, int by) {
+    DepthTile& tile = depth_tiles_.data()[by * block_cols_ + bx];
+    if (tile.planes == 0) return;
+
+    int size = 1 << kTileShift;
+    int x_end = math::Min((bx + 1) * size, width_);
+    int y_end = math::Min((by + 1) * size, height_);
+    for (int y = by * size; y < y_end; ++y) {
+        for (int x = bx * size; x < x_end; ++x) {
+            for (int i = 0; i < sample_size_; ++i) {
+                depth_buffer_.data()[Index(x, y, i)] = TileDepth(tile, x, y, i);
+            }
+        }
+    }
+    tile.planes = 0;
+}
+
+void RenderTexture::DecompressDepth() {
+    for (int by = 0; by < block_rows_; ++by) {
+        for (int bx = 0; bx < block_cols_; ++bx) {
+            DecompressTile(bx, by);
+        }
+    }
 }
 
 Vec2f RenderTexture::GetSubSample(int x, int y, int sub_sample) {
@@ -53,18 +263,44 @@ float RenderTexture::GetDepth(int x, int y) const {
 
 Vec4f RenderTexture::GetColor(int x, int y, int sub_sample) const {
     assert(sub_sample < sample_size_);
-    return color_buffer_.Get((x << sample_exp_) + sub_sample, y);
+    size_t pixel = PixelIndex(x, y);
+    if (color_slots_ == 1) {
+        return color_buffer_.data()[pixel];
+    }
+
+    uint16_t fragments = fragment_mask_.data()[pixel];
+    if (fragments == kExpanded) {
+        return ExpandedSamples(x, y)[sub_sample];
+    }
+    return color_buffer_.data()[pixel * kColorSlots + ((fragments >> sub_sample) & 1)];
 }
 
 float RenderTexture::GetDepth(int x, int y, int sub_sample) const {
-    assert(sub_sample < sample_size_);
-    return depth_buffer_.Get((x << sample_exp_) + sub_sample, y);
+    const DepthTile& tile = GetDepthTile(x, y);
+    if (tile.planes != 0) {
+        return TileDepth(tile, x, y, sub_sample);
+    }
+    return depth_buffer_.data()[Index(x, y, sub_sample)];
 }
 
-void RenderTexture::SetColor(int x, int y, const Vec4f& color) {
-    for (int i = 0; i < sample_size_; ++i) {
-        SetColor(x, y, color, i);
+uint32_t RenderTexture::GetId(int x, int y, int sub_sample) const {
+    return id_buffer_.data()[Index(x, y, sub_sample)];
+}
+
+const float* RenderTexture::GetDepthSamples(int x, int y, int count, float* scratch) const {
+    const DepthTile& tile = GetDepthTile(x, y);
+    if (tile.planes == 0) {
+        return depth_buffer_.data().data() + Index(x, y, 0);
+    }
+
+    for (int n = 0; n < count; ++n) {
+        scratch[n] = TileDepth(tile, x + (n >> sample_exp_), y, n & (sample_size_ - 1));
     }
+    return scratch;
+}
+
+void RenderTexture::SetColor(int x, int y, const Vec4f& color) {
+    SetColorSamples(x, y, color, (1 << sample_size_) - 1);
 }
 
 void RenderTexture::SetDepth(int x, int y, float depth) {
@@ -75,12 +311,168 @@ void RenderTexture::SetDepth(int x, int y, float depth) {
 
 void RenderTexture::SetColor(int x, int y, const Vec4f& color, int sub_sample) {
     assert(sub_sample < sample_size_);
-    color_buffer_.Set((x << sample_exp_) + sub_sample, y, color);
+    SetColorSamples(x, y, color, 1 << sub_sample);
+}
+
+void RenderTexture::SetColorSamples(int x, int y, const Vec4f& color, int mask) {
+    size_t pixel = PixelIndex(x, y);
+    Vec4f* slots = color_buffer_.data().data() + pixel * color_slots_;
+    int all = (1 << sample_size_) - 1;
+    mask &= all;
+    if (mask == 0) return;
+
+    if (color_slots_ == 1) {
+        slots[0] = color;
+        return;
+    }
+
+    uint16_t& fragments = fragment_mask_.data()[pixel];
+    //a fragment covering the whole pixel replaces everything, the common case away from edges.
+    //expanded pixels go back to a single color as well
+    if (mask == all) {
+        slots[0] = color;
+        fragments = 0;
+        return;
+    }
+
+    if (fragments == kExpanded) {
+        Vec4f* samples = ExpandedSamples(x, y);
+        for (int i = 0; i < sample_size_; ++i) {
+            if ((mask & (1 << i)) != 0) {
+                samples[i] = color;
+            }
+        }
+        return;
+    }
+
+    //slots still used by the samples the fragment leaves alone
+    int kept = 0;
+    int kept_count[2] = { 0, 0 };
+    int covered = 0;
+    for (int i = 0; i < sample_size_; ++i) {
+        if ((mask & (1 << i)) == 0) {
+            int used = (fragments >> i) & 1;
+            kept |= 1 << used;
+            ++kept_count[used];
+        } else {
+            ++covered;
+        }
+    }
+
+    int slot;
+    if (kept != 3) {
+        slot = kept == 1 ? 1 : 0;
+        slots[slot] = color;
+    } else if (slots[0] == color) {
+        slot = 0;
+    } else if (slots[1] == color) {
+        slot = 1;
+    } else if (!expandable_) {
+        //a third fragment under EQAA takes over one of the colors. the samples left on it are still visible,
+        //so they share the fragment color with the dropped one blended in by sample count, which keeps the
+        //box resolve of the pixel. the color dropped is the one whose samples move least by that, mostly a
+        //neighbouring triangle of the same surface rather than the background
+        float cost[2];
+        for (int k = 0; k < 2; ++k) {
+            Vec4f diff = slots[k] - color;
+            cost[k] = kept_count[k] * (std::abs(diff.r) + std::abs(diff.g) + std::abs(diff.b));
+        }
+        slot = cost[1] < cost[0] ? 1 : 0;
+        slots[slot] = (color * (float)covered + slots[slot] * (float)kept_count[slot]) / (float)(covered + kept_count[slot]);
+    } else {
+        //a third fragment, keep every sample
+        Vec4f* samples = ExpandedSamples(x, y);
+        for (int i = 0; i < sample_size_; ++i) {
+            samples[i] = (mask & (1 << i)) != 0 ? color : slots[(fragments >> i) & 1];
+        }
+        fragments = kExpanded;
+        return;
+    }
+
+    fragments = slot ? (fragments | mask) : (fragments & ~mask);
 }
 
 void RenderTexture::SetDepth(int x, int y, float depth, int sub_sample) {
-    assert(sub_sample < sample_size_);
-    depth_buffer_.Set((x << sample_exp_) + sub_sample, y, depth);
+    //a single sample has no plane to go with
+    DecompressTile(x >> kTileShift, y >> kTileShift);
+    depth_buffer_.data()[Index(x, y, sub_sample)] = depth;
+    UpdateHiZ(x, y, depth);
+}
+
+void RenderTexture::SetDepthSamples(int x, int y, int mask, const float* depth, const DepthPlane& plane) {
+    mask &= (1 << sample_size_) - 1;
+    if (mask == 0) return;
+
+    float min_depth = std::numeric_limits<float>::infinity();
+    for (int i = 0; i < sample_size_; ++i) {
+        if ((mask & (1 << i)) != 0) {
+            min_depth = math::Min(min_depth, depth[i]);
+        }
+    }
+    UpdateHiZ(x, y, min_depth);
+
+    DepthTile& tile = GetDepthTile(x, y);
+    if (tile.planes != 0) {
+        int bit = SelectorBit(x, y, 0);
+        int word = bit >> 6;
+        uint64_t samples = (uint64_t)mask << (bit & 63);
+        if (tile.plane[0] == plane) {
+            tile.selector[word] &= ~samples;
+            return;
+        }
+        if (tile.planes == 2 && tile.plane[1] == plane) {
+            tile.selector[word] |= samples;
+            return;
+        }
+
+        //a new plane can take over a plane no sample outside the mask is left on
+        int bx = x >> kTileShift;
+        int by = y >> kTileShift;
+        int size = 1 << kTileShift;
+        int cols = math::Min(size, width_ - bx * size);
+        int rows = math::Min(size, height_ - by * size);
+        int words = 1 << sample_exp_;
+        int row_bits = cols << sample_exp_;
+        uint64_t row_mask = row_bits == 64 ? ~(uint64_t)0 : ((uint64_t)1 << row_bits) - 1;
+        bool used[2] = { false, false };
+        for (int r = 0; r < rows; ++r) {
+            //a row of the block never straddles two selector words
+            int first = (r * size) << sample_exp_;
+            uint64_t kept = (row_mask << (first & 63)) & ~(first >> 6 == word ? samples : 0);
+            uint64_t on_plane1 = tile.selector[first >> 6];
+            used[0] = used[0] || (kept & ~on_plane1) != 0;
+            used[1] = used[1] || (kept & on_plane1) != 0;
+        }
+
+        if (!used[0] && !used[1]) {
+            tile.planes = 1;
+            tile.plane[0] = plane;
+            std::fill(tile.selector, tile.selector + words, 0);
+            return;
+        }
+        if (!used[0]) {
+            tile.plane[0] = plane;
+            tile.selector[word] &= ~samples;
+            return;
+        }
+        if (!used[1]) {
+            tile.planes = 2;
+            tile.plane[1] = plane;
+            tile.selector[word] |= samples;
+            return;
+        }
+        DecompressTile(bx, by);
+    }
+
+    for (int i = 0; i < sample_size_; ++i) {
+        if ((mask & (1 << i)) != 0) {
+            depth_buffer_.data()[Index(x, y, i)] = depth[i];
+        }
+    }
+}
+
+void RenderTexture::SetId(int x, int y, uint32_t id, int sub_sample) {
+    id_buffer_.data()[Index(x, y, sub_sample)] = id;
 }
 
 void RenderTexture::Clear(Buffers buff, const Vec3f& color) {
@@ -88,10 +480,111 @@ void RenderTexture::Clear(Buffers buff, const Vec3f& color) {
         Vec3f linear_color = GammaToLinearSpace(color);
         Vec4f col(linear_color.r, linear_color.g, linear_color.b, 1.0f);
         color_buffer_.Fill(col);
+        //expanded blocks stay allocated for the next frame
+        fragment_mask_.Fill(0);
     }
 
     if ((buff & Buffers::kDepth) == Buffers::kDepth) {
-        depth_buffer_.Fill(std::numeric_limits<float>::infinity());
+        //every block back to a single plane at infinity, the raw samples are not touched
+        DepthTile cleared = {};
+        cleared.planes = 1;
+        cleared.plane[0] = { std::numeric_limits<float>::infinity(), 0.0f, 0.0f, 0, 0 };
+        depth_tiles_.Fill(cleared);
+        for (auto& level : hiz_) {
+            level.max_depth.Fill(std::numeric_limits<float>::infinity());
+            level.min_depth.Fill(std::numeric_limits<float>::infinity());
+            level.dirty.Fill(0);
+        }
+    }
+
+    if ((buff & Buffers::kId) == Buffers::kId) {
+        //same layout as the depth samples
+        id_buffer_.Resize(depth_buffer_.width(), depth_buffer_.height());
+        id_buffer_.Fill(0);
+    }
+}
+
+Vec4f RenderTexture::WeightedColor(int x, int y, const float* weights) const {
+    size_t pixel = PixelIndex(x, y);
+    const Vec4f* slots = color_buffer_.data().data() + pixel * color_slots_;
+    uint16_t fragments = color_slots_ == 1 ? 0 : fragment_mask_.data()[pixel];
+
+    if (fragments == kExpanded) {
+        const Vec4f* samples = ExpandedSamples(x, y);
+        Vec4f color;
+        for (int i = 0; i < sample_size_; ++i) {
+            color += samples[i] * weights[i];
+        }
+        return color;
+    }
+
+    //two colors at most, weight each slot once instead of every sample
+    float slot_weights[2] = { 0.0f, 0.0f };
+    for (int i = 0; i < sample_size_; ++i) {
+        slot_weights[(fragments >> i) & 1] += weights[i];
+    }
+
+    //every sample holds the same color, the common case away from edges
+    if (fragments == 0) {
+        return slots[0] * slot_weights[0];
+    }
+    return slots[0] * slot_weights[0] + slots[1] * slot_weights[1];
+}
+
+void RenderTexture::Resolve(ResolveFilter filter, ThreadPool* pool) {
+    //a single sample is its own resolve, ColorToImage reads the color buffer
+    if (sample_size_ == 1) return;
+
+    //weights of the samples of the 3x3 pixels around the resolved one, a box only reads the center
+    constexpr int kTaps = 9;
+    float weights[kTaps][kMaxSampleSize] = {};
+    int radius = filter == ResolveFilter::kTent ? 1 : 0;
+    for (int dy = -radius; dy <= radius; ++dy) {
+        for (int dx = -radius; dx <= radius; ++dx) {
+            float* tap = weights[(dy + 1) * 3 + dx + 1];
+            for (int i = 0; i < sample_size_; ++i) {
+                if (filter == ResolveFilter::kBox) {
+                    tap[i] = 1.0f / sample_size_;
+                } else {
+                    const Vec2f& offset = msaa_pattern_[i];
+                    tap[i] = math::Max(0.0f, 1.0f - std::abs(dx + offset.x)) * math::Max(0.0f, 1.0f - std::abs(dy + offset.y));
+                }
+            }
+        }
+    }
+
+    auto resolve_row = [&](int y) {
+        Vec4f* row = resolved_buffer_.data().data() + (size_t)y * width_;
+        for (int x = 0; x < width_; ++x) {
+            if (radius == 0) {
+                row[x] = WeightedColor(x, y, weights[4]);
+                continue;
+            }
+
+            //taps outside the texture are dropped and the rest renormalized
+            Vec4f color;
+            float weight = 0.0f;
+            for (int dy = -1; dy <= 1; ++dy) {
+                if (y + dy < 0 || y + dy >= height_) continue;
+                for (int dx = -1; dx <= 1; ++dx) {
+                    if (x + dx < 0 || x + dx >= width_) continue;
+                    const float* tap = weights[(dy + 1) * 3 + dx + 1];
+                    color += WeightedColor(x + dx, y + dy, tap);
+                    for (int i = 0; i < sample_size_; ++i) {
+                        weight += tap[i];
+                    }
+                }
+            }
+            row[x] = color / weight;
+        }
+    };
+
+    if (pool) {
+        pool->ParallelFor(height_, resolve_row);
+    } else {
+        for (int y = 0; y < height_; ++y) {
+            resolve_row(y);
+        }
     }
 }
 
@@ -99,9 +592,10 @@ void RenderTexture::ColorToImage(Buffer<Col3U8>& image_buffer) {
     assert(image_buffer.width() == width_);
     assert(image_buffer.height() == height_);
     
+    const Vec4f* resolved = resolved_buffer_.data().data();
     for (int i = 0; i< height_; ++i) {
         for (int j = 0;j < width_; ++j) {
-            Vec4f col = GetColor(j, i);
+            Vec4f col = sample_size_ > 1 ? resolved[(size_t)i * width_ + j] : color_buffer_.data()[PixelIndex(j, i)];
             Vec3f color(col.r, col.g, col.b);
 
             // HDR tonemapping
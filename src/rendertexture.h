@@ -1,6 +1,8 @@
 #pragma once
 
 #include <vector>
+#include <memory>
+#include <atomic>
 #include <assert.h>
 #include "math/vec3.h"
 #include "math/mat4.h"
@@ -11,36 +13,113 @@
 
 namespace rendertoy {
 
+class ThreadPool;
+
+//depth of a triangle in screen space: z = z0 + dzdx * dx + dzdy * dy, dx and dy in pixels from the center of pixel (x0, y0).
+//the rasterizer and compressed depth tiles evaluate it the same way, so both see bit-identical sample depths
+struct DepthPlane {
+    float z0;
+    float dzdx;
+    float dzdy;
+    int x0;
+    int y0;
+
+    //depth at the sample with the given offset from the center of pixel (x, y)
+    float At(int x, int y, const Vec2f& offset) const {
+        return z0 + dzdx * ((float)(x - x0) + offset.x) + dzdy * ((float)(y - y0) + offset.y);
+    }
+
+    bool operator ==(const DepthPlane& o) const {
+        return z0 == o.z0 && dzdx == o.dzdx && dzdy == o.dzdy && x0 == o.x0 && y0 == o.y0;
+    }
+};
+
 class RenderTexture : private Uncopyable{
 public:
+    static constexpr int kMaxSampleSize = 8;
+
+    //hierarchical z: level 0 keeps the depth range of 8x8 pixel blocks,
+    //every level above covers 8x8 blocks of the level below (64x64 pixels for level 1)
+    static constexpr int kHiZShift = 3;
+    static constexpr int kHiZLevels = 2;
+    //the tiled layout stores 8x8 pixel tiles with their samples contiguously, a tile is one hierarchical z block
+    static constexpr int kTileShift = kHiZShift;
+
+    //depth is stored per 8x8 block as up to kDepthPlanes planes with the plane of every sample,
+    //blocks touched by more triangles than that are decompressed to raw samples until the next clear
+    static constexpr int kDepthPlanes = 2;
+
+    //compressed MSAA colors: a pixel stores up to kColorSlots fragment colors and the slot of each sample.
+    //pixels covered by more fragments than that move to full per sample storage, allocated per 8x8 block.
+    //EQAA never expands, a third fragment is blended into one of the colors and takes over the samples left on it
+    static constexpr int kColorSlots = 2;
+
     RenderTexture(int w, int h, MSAALevel lvl = MSAALevel::kNone);
+    ~RenderTexture();
 
     int height() const { return height_; }
     int width() const { return width_; }
 
-    const Buffer<Vec4f>& color_buffer() const { return color_buffer_; }
+    //raw storage, row-major with the samples of a pixel next to each other unless tiled() is set.
+    //colors are compressed under MSAA and only reachable through GetColor, depth is current after DecompressDepth
     const Buffer<float>& depth_buffer() const { return depth_buffer_; }
+    //visibility buffer: id of the triangle covering each sample, 0 for none.
+    //empty until the first Clear of Buffers::kId, which the visibility path does before drawing
+    const Buffer<uint32_t>& id_buffer() const { return id_buffer_; }
 
     const MSAALevel msaa() const { return msaa_; }
     void msaa(MSAALevel lvl);
     const int sample_size() const { return sample_size_; }
 
+    //store the buffers in 8x8 pixel tiles instead of rows, the contents are dropped.
+    //pixels close in both directions share cache lines, the Get/Set API does not change
+    void tiled(bool on);
+    bool tiled() const { return tiled_; }
+
     Vec2f GetSubSample(int x, int y, int sub_sample);
+    //sample position relative to the pixel center
+    const Vec2f& GetSampleOffset(int sub_sample) const { return msaa_pattern_[sub_sample]; }
 
     void SetColor(int x, int y, const Vec4f& color);
     void SetDepth(int x, int y, float depth);
 
     void SetColor(int x, int y, const Vec4f& color, int sub_sample);
+    //one fragment color for the samples set in mask, the way fragments should be written under MSAA
+    void SetColorSamples(int x, int y, const Vec4f& color, int mask);
     void SetDepth(int x, int y, float depth, int sub_sample);
+    //depth of the samples set in mask, all of them on plane. the way triangles should write depth,
+    //blocks stay compressed as long as they are covered by few planes
+    void SetDepthSamples(int x, int y, int mask, const float* depth, const DepthPlane& plane);
+    void SetId(int x, int y, uint32_t id, int sub_sample);
     
     Vec4f GetColor(int x, int y) const;
     float GetDepth(int x, int y) const;
 
     Vec4f GetColor(int x, int y, int sub_sample) const;
     float GetDepth(int x, int y, int sub_sample) const;
+    uint32_t GetId(int x, int y, int sub_sample) const;
+
+    //depth of count samples from sample 0 of pixel (x, y) on, along the row and within its 8 pixel block.
+    //points into the raw storage or, for compressed blocks, at the samples evaluated into scratch
+    const float* GetDepthSamples(int x, int y, int count, float* scratch) const;
+    //write every compressed block to the raw storage, for readers of depth_buffer
+    void DecompressDepth();
+
+    //farthest depth in block (bx, by) of a hierarchical z level, rebuilt lazily after depth writes.
+    //a triangle whose nearest depth is not closer than this fails the depth test everywhere in the block.
+    float GetMaxDepth(int level, int bx, int by);
+    //nearest depth in block (bx, by) of a hierarchical z level
+    float GetMinDepth(int level, int bx, int by) const;
 
     void Clear(Buffers buff, const Vec3f& color = { 49.0f / 255.0f, 77.0f / 255.0f,121.0f / 255.0f});
 
+    //filter the samples of every pixel into the resolved buffer, one row per job if a pool is given.
+    //has to run again after drawing, the render texture does not track changes since the last resolve
+    void Resolve(ResolveFilter filter = ResolveFilter::kBox, ThreadPool* pool = nullptr);
+    //single sample colors written by Resolve, row-major. empty without MSAA, the color buffer is already resolved
+    const Buffer<Vec4f>& resolved_buffer() const { return resolved_buffer_; }
+
+    //tone maps the resolved buffer, or the color buffer without MSAA
     void ColorToImage(Buffer<Col3U8>& image_buffer);
     void DepthToImage(Buffer<Col3U8>& image_buffer);
 
@@ -62,6 +141,80 @@ private:
         {-0.125f, -0.375f}
     };
 
+    static constexpr Vec2f kMSAAPattern8[] = {
+        {0.0625f, -0.1875f},
+        {-0.0625f, 0.1875f},
+        {0.3125f, 0.0625f},
+        {-0.1875f, -0.3125f},
+        {-0.3125f, 0.3125f},
+        {-0.4375f, -0.0625f},
+        {0.1875f, 0.4375f},
+        {0.4375f, -0.4375f}
+    };
+
+    struct DepthTile {
+        int planes; //0 if the samples are in depth_buffer_
+        DepthPlane plane[kDepthPlanes];
+        uint64_t selector[kMaxSampleSize]; //bit (pixel << sample_exp_) + sample is set for samples on plane 1
+    };
+
+    struct HiZLevel {
+        Buffer<float> max_depth;
+        Buffer<float> min_depth;
+        Buffer<uint8_t> dirty; //max_depth is stale and has to be rebuilt from the level below
+    };
+
+    void ResizeBuffers();
+    void ResizeHiZ();
+    //position of a sample in the buffers
+    size_t Index(int x, int y, int sub_sample) const {
+        assert(x >= 0 && x < width_);
+        assert(y >= 0 && y < height_);
+        assert(sub_sample < sample_size_);
+        if (!tiled_) {
+            return (((size_t)y * width_ + x) << sample_exp_) + sub_sample;
+        }
+
+        int mask = (1 << kTileShift) - 1;
+        size_t tile = (size_t)(y >> kTileShift) * tile_cols_ + (x >> kTileShift);
+        size_t pixel = (tile << (kTileShift * 2)) + ((y & mask) << kTileShift) + (x & mask);
+        return (pixel << sample_exp_) + sub_sample;
+    }
+
+    //position of a pixel in the per pixel buffers, in the layout of Index
+    size_t PixelIndex(int x, int y) const {
+        return Index(x, y, 0) >> sample_exp_;
+    }
+
+    //per sample colors of an expanded pixel, the non-const version allocates the storage of its block
+    Vec4f* ExpandedSamples(int x, int y);
+    const Vec4f* ExpandedSamples(int x, int y) const;
+    void ReleaseExpanded();
+
+    void UpdateHiZ(int x, int y, float depth);
+
+    DepthTile& GetDepthTile(int x, int y) { return depth_tiles_.data()[(y >> kTileShift) * block_cols_ + (x >> kTileShift)]; }
+    const DepthTile& GetDepthTile(int x, int y) const { return depth_tiles_.data()[(y >> kTileShift) * block_cols_ + (x >> kTileShift)]; }
+    //bit of a sample in DepthTile::selector
+    int SelectorBit(int x, int y, int sub_sample) const {
+        int mask = (1 << kTileShift) - 1;
+        return ((((y & mask) << kTileShift) + (x & mask)) << sample_exp_) + sub_sample;
+    }
+    float TileDepth(const DepthTile& tile, int x, int y, int sub_sample) const {
+        int bit = SelectorBit(x, y, sub_sample);
+        int plane = (tile.selector[bit >> 6] >> (bit & 63)) & 1;
+        return tile.plane[plane].At(x, y, msaa_pattern_[sub_sample]);
+    }
+    void DecompressTile(int bx, int by);
+    //upper bound of the planes of a compressed tile over the block
+    float TileMaxDepth(const DepthTile& tile, int bx, int by) const;
+
+    //sum of the samples of a pixel scaled by weights, one per sample
+    Vec4f WeightedColor(int x, int y, const float* weights) const;
+
+    //fragment mask of a pixel: bit i is the color slot of sample i, kExpanded for full per sample storage
+    static constexpr uint16_t kExpanded = 0x8000;
+
     MSAALevel msaa_;
     const Vec2f* msaa_pattern_;
     int sample_exp_;
@@ -69,9 +222,21 @@ private:
 
     int width_;
     int height_;
+    bool tiled_;
+    int tile_cols_;
 
+    int color_slots_; //colors stored per pixel, 1 without MSAA
+    bool expandable_; //pixels can move to per sample colors, false for EQAA
+    int block_cols_;
+    int block_rows_;
     Buffer<Vec4f> color_buffer_;
+    Buffer<uint16_t> fragment_mask_;
+    std::unique_ptr<std::atomic<Vec4f*>[]> expanded_; //per 8x8 block, nullptr until a pixel in it expands. null without MSAA
+    Buffer<Vec4f> resolved_buffer_;
     Buffer<float> depth_buffer_;
+    Buffer<DepthTile> depth_tiles_; //per 8x8 block
+    Buffer<uint32_t> id_buffer_;
+    HiZLevel hiz_[kHiZLevels];
 };
 
 }
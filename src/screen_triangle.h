@@ -2,85 +2,255 @@
 
 #include "vertex.h"
 #include <cmath>
+#include <stdint.h>
+#include "math/simd.h"
 
 namespace rendertoy {
 
+//edge function values of the three edges at one sample position, in fixed point
+using EdgeValues = math::Vec3<int64_t>;
+
+enum class BlockClass : uint8_t {
+    kOutside,
+    kPartial,
+    kInside
+};
+
+//an attribute multiplied by 1/w is affine in screen space: base + ddx * dx + ddy * dy,
+//dx and dy in pixels from the pixel center the plane is based at
+template <typename T>
+struct AttributePlane {
+    T base;
+    T ddx;
+    T ddy;
+
+    T At(float dx, float dy) const {
+        return base + ddx * dx + ddy * dy;
+    }
+};
+
 struct ScreenTriangle : private Uncopyable {
-    ScreenTriangle(const VertexOut& v0_, const VertexOut& v1_, const VertexOut& v2_, RenderTexture* render_texture) : 
+    //vertices are snapped to a 1/256 pixel grid, which also holds every MSAA sample position exactly
+    static constexpr int kSubPixelBits = 8;
+    static constexpr int kSubPixelStep = 1 << kSubPixelBits;
+    static constexpr int kSubPixelHalf = kSubPixelStep / 2;
+
+    //consecutive depth buffer slots (pixels x samples along a row) tested together by CoverageBlock
+    static constexpr int kBlockSlots = 8;
+    //block edge values are clamped to this before going to 32 bit lanes, the lane offsets must stay below it
+    static constexpr int64_t kBlockClamp = int64_t(1) << 30;
+
+    //only the given varyings are interpolated, kNone if the triangle is not shaded
+    ScreenTriangle(const VertexOut& v0_, const VertexOut& v1_, const VertexOut& v2_, RenderTexture* render_texture, Varyings varyings_) :
         v0(v0_), v1(v1_), v2(v2_),
+        varyings(varyings_),
         render_texture_(render_texture)
     {
         const Vec4f& p0 = v0.position;
         const Vec4f& p1 = v1.position;
         const Vec4f& p2 = v2.position;
 
-        float min_x = math::Min(p0.x, math::Min(p1.x, p2.x));
-        float min_y = math::Min(p0.y, math::Min(p1.y, p2.y));
-        float max_x = math::Max(p0.x, math::Max(p1.x, p2.x));
-        float max_y = math::Max(p0.y, math::Max(p1.y, p2.y));
-        
-        min.x = math::Max((int)std::floor(min_x), 0);
-        min.y = math::Max((int)std::floor(min_y), 0);
+        int64_t x0 = Snap(p0.x), y0 = Snap(p0.y);
+        int64_t x1 = Snap(p1.x), y1 = Snap(p1.y);
+        int64_t x2 = Snap(p2.x), y2 = Snap(p2.y);
+
+        int64_t min_x = math::Min(x0, math::Min(x1, x2));
+        int64_t min_y = math::Min(y0, math::Min(y1, y2));
+        int64_t max_x = math::Max(x0, math::Max(x1, x2));
+        int64_t max_y = math::Max(y0, math::Max(y1, y2));
 
-        max.x = math::Min((int)std::ceil(max_x), render_texture_->width() - 1);
-        max.y = math::Min((int)std::ceil(max_y), render_texture_->height() - 1);
+        min.x = math::Max((int)(min_x >> kSubPixelBits), 0);
+        min.y = math::Max((int)(min_y >> kSubPixelBits), 0);
 
-        area2_reciprocal = 1.0f / math::Abs((p0.x - p1.x) * (p2.y - p1.y) - (p0.y - p1.y) * (p2.x - p1.x));
+        max.x = math::Min((int)((max_x + kSubPixelStep - 1) >> kSubPixelBits), render_texture_->width() - 1);
+        max.y = math::Min((int)((max_y + kSubPixelStep - 1) >> kSubPixelBits), render_texture_->height() - 1);
 
-        edge[0] = {p1.x - p0.x, p1.y - p0.y, p0.x, p0.y}; //p0-p1
-        edge[1] = {p2.x - p1.x, p2.y - p1.y, p1.x, p1.y}; //p1-p2
-        edge[2] = {p0.x - p2.x, p0.y - p2.y, p2.x, p2.y}; //p2-p0
+        min_z = math::Min(p0.z, math::Min(p1.z, p2.z));
+
+        SetupEdge(0, x0, y0, x1, y1); //p0-p1
+        SetupEdge(1, x1, y1, x2, y2); //p1-p2
+        SetupEdge(2, x2, y2, x0, y0); //p2-p0
+
+        //twice the signed area, callers hand in counter clockwise triangles (see is_front)
+        int64_t area2 = (y1 - y0) * (x2 - x0) - (x1 - x0) * (y2 - y0);
+        if (area2 <= 0) {
+            //degenerated after snapping, nothing to rasterize
+            max.x = min.x - 1;
+            max.y = min.y - 1;
+            area2 = 1;
+        }
+        area2_reciprocal = 1.0f / area2;
+
+        step_x = EdgeValues(edge_a[0], edge_a[1], edge_a[2]) * (int64_t)kSubPixelStep;
+        step_y = EdgeValues(edge_b[0], edge_b[1], edge_b[2]) * (int64_t)kSubPixelStep;
+
+        int samples = render_texture_->sample_size();
+        for (int i = 0; i < samples; ++i) {
+            Vec2f offset = render_texture_->GetSampleOffset(i);
+            sample_pos[i] = offset;
+            int64_t dx = std::lround(offset.x * kSubPixelStep);
+            int64_t dy = std::lround(offset.y * kSubPixelStep);
+            sample_offset[i] = EdgeValues(
+                edge_a[0] * dx + edge_b[0] * dy,
+                edge_a[1] * dx + edge_b[1] * dy,
+                edge_a[2] * dx + edge_b[2] * dy
+            );
+            for (int k = 0; k < 3; ++k) {
+                sample_min[k] = i == 0 ? sample_offset[i][k] : math::Min(sample_min[k], sample_offset[i][k]);
+                sample_max[k] = i == 0 ? sample_offset[i][k] : math::Max(sample_max[k], sample_offset[i][k]);
+            }
+        }
+
+        SetupDepthPlane(area2);
+        SetupBlock(samples);
+        SetupPlanes();
+    }
+
+    static int64_t Snap(float v) {
+        return std::llround(v * kSubPixelStep);
     }
 
-    float TopLeftEdge(const Vec4f& e) const {
-        return e.y > 0 || (e.y == 0 && e.x > 0) ? 0.0f : -1.0f;
+    //top-left fill rule: samples exactly on an edge belong to the triangle only for top or left edges
+    static bool TopLeftEdge(int64_t dx, int64_t dy) {
+        return dy > 0 || (dy == 0 && dx > 0);
     }
 
-    float EdgeEquation(float x, float y, int idx, bool check_topleft=true) const {
-        const Vec4f& e = edge[idx];
-        float v = e.y* (x - e.z) - e.x * (y - e.w);
-        if (v == 0.0f && check_topleft) {
-            return TopLeftEdge(e);
-        } else {
-            return v;
+    void SetupEdge(int idx, int64_t xa, int64_t ya, int64_t xb, int64_t yb) {
+        int64_t dx = xb - xa;
+        int64_t dy = yb - ya;
+        edge_a[idx] = dy;
+        edge_b[idx] = -dx;
+        edge_c[idx] = dx * ya - dy * xa;
+        // an integer edge function can be biased by one to turn >= 0 into > 0 for the non top-left edges
+        if (!TopLeftEdge(dx, dy)) {
+            edge_c[idx] -= 1;
         }
     }
 
-    bool Inside(const Vec2f& pos, Vec3f& weight) const {
-        float x = pos.x;
-        float y = pos.y;
+    //depth after the perspective divide is affine in screen space, the plane is based at the center of pixel min
+    void SetupDepthPlane(int64_t area2) {
+        const VertexOut* opposite[3] = { &v2, &v0, &v1 };
+        EdgeValues e = EdgeEquation(min.x, min.y);
+        double z0 = 0.0, dzdx = 0.0, dzdy = 0.0;
+        for (int k = 0; k < 3; ++k) {
+            double z = (double)opposite[k]->position.z / (double)area2;
+            z0 += (double)e[k] * z;
+            dzdx += (double)(edge_a[k] * kSubPixelStep) * z;
+            dzdy += (double)(edge_b[k] * kSubPixelStep) * z;
+        }
+        depth_plane = { (float)z0, (float)dzdx, (float)dzdy, min.x, min.y };
+    }
 
-        float e0 = EdgeEquation(x, y, 1);
-        if (e0 < 0.0f) return false;
+    void SetupBlock(int samples) {
+        int sample_exp = 0;
+        while ((1 << sample_exp) < samples) {
+            ++sample_exp;
+        }
 
-        float e1 = EdgeEquation(x, y, 2);
-        if (e1 < 0.0f) return false;
+        block_coverage = true;
+        for (int k = 0; k < 3; ++k) {
+            for (int i = 0; i < kBlockSlots; ++i) {
+                int64_t offset = step_x[k] * (i >> sample_exp) + sample_offset[i & (samples - 1)][k];
+                if (math::Abs(offset) >= kBlockClamp) {
+                    //huge triangle, the 32 bit lanes could overflow
+                    block_coverage = false;
+                }
+                block_offset[k][i] = (int32_t)offset;
+            }
+        }
 
-        float e2 = EdgeEquation(x, y, 0);
-        if (e2 < 0.0f) return false;
+        for (int i = 0; i < kBlockSlots; ++i) {
+            const Vec2f& offset = sample_pos[i & (samples - 1)];
+            block_dx[i] = (float)(i >> sample_exp) + offset.x;
+            block_dy[i] = offset.y;
+        }
+    }
 
-        float alpha = e0 * area2_reciprocal;
-        float beta = e1 * area2_reciprocal;
-        float gamma = e2 * area2_reciprocal;
+    //attribute planes based at the center of pixel min, close to every pixel that is rasterized
+    void SetupPlanes() {
+        EdgeValues e = EdgeEquation(min.x, min.y);
+        SetupPlane(w_plane, 1.0f, 1.0f, 1.0f, e);
+        SetupPlane(planes.w_reciprocal, v0.w_reciprocal, v1.w_reciprocal, v2.w_reciprocal, e);
+        SetupPlane(planes.position, v0.position, v1.position, v2.position, e);
+        if (Interpolates(Varyings::kWorldPosition)) SetupPlane(planes.world_position, v0.world_position, v1.world_position, v2.world_position, e);
+        if (Interpolates(Varyings::kColor)) SetupPlane(planes.color, v0.color, v1.color, v2.color, e);
+        if (Interpolates(Varyings::kNormal)) SetupPlane(planes.normal, v0.normal, v1.normal, v2.normal, e);
+        if (Interpolates(Varyings::kTangent)) SetupPlane(planes.tangent, v0.tangent, v1.tangent, v2.tangent, e);
+        if (Interpolates(Varyings::kTexcoord)) SetupPlane(planes.texcoord, v0.texcoord, v1.texcoord, v2.texcoord, e);
+        if (Interpolates(Varyings::kShadowCoord)) SetupPlane(planes.shadow_coord, v0.shadow_coord, v1.shadow_coord, v2.shadow_coord, e);
+    }
 
-        //depth in view space reciprocal (z)
-        float w_reciprocal = 1.0f / (alpha * v0.w_reciprocal + beta * v1.w_reciprocal + gamma * v2.w_reciprocal);
-        weight[0] = alpha * v0.w_reciprocal * w_reciprocal;
-        weight[1] = beta * v1.w_reciprocal * w_reciprocal;
-        weight[2] = gamma * v2.w_reciprocal * w_reciprocal;
+    bool Interpolates(Varyings v) const {
+        return (varyings & v) == v;
+    }
 
-        return true;
+    //the barycentric weight of a vertex is the edge function of the opposite edge over the area
+    template <typename T>
+    void SetupPlane(AttributePlane<T>& plane, const T& a0, const T& a1, const T& a2, const EdgeValues& e) const {
+        T q0 = a0 * v0.w_reciprocal;
+        T q1 = a1 * v1.w_reciprocal;
+        T q2 = a2 * v2.w_reciprocal;
+        float step = kSubPixelStep * area2_reciprocal;
+        plane.base = q0 * (e[1] * area2_reciprocal) + q1 * (e[2] * area2_reciprocal) + q2 * (e[0] * area2_reciprocal);
+        plane.ddx = q0 * (edge_a[1] * step) + q1 * (edge_a[2] * step) + q2 * (edge_a[0] * step);
+        plane.ddy = q0 * (edge_b[1] * step) + q1 * (edge_b[2] * step) + q2 * (edge_b[0] * step);
+    }
+
+    //conservative test of the rectangle [x, x + width] x [y, y + height] against the edges,
+    //each edge is evaluated at the block corner nearest to and farthest from its inside
+    BlockClass ClassifyBlock(int x, int y, int width, int height) const {
+        int64_t sx = (int64_t)x * kSubPixelStep;
+        int64_t sy = (int64_t)y * kSubPixelStep;
+        int64_t extent_x = (int64_t)width * kSubPixelStep;
+        int64_t extent_y = (int64_t)height * kSubPixelStep;
+
+        bool inside = true;
+        for (int k = 0; k < 3; ++k) {
+            int64_t e = edge_a[k] * sx + edge_b[k] * sy + edge_c[k];
+            int64_t lo = e + math::Min(edge_a[k], (int64_t)0) * extent_x + math::Min(edge_b[k], (int64_t)0) * extent_y;
+            int64_t hi = e + math::Max(edge_a[k], (int64_t)0) * extent_x + math::Max(edge_b[k], (int64_t)0) * extent_y;
+            if (hi < 0) return BlockClass::kOutside;
+            if (lo < 0) inside = false;
+        }
+        return inside ? BlockClass::kInside : BlockClass::kPartial;
+    }
+
+    //samples of the pixel with edge values e at its center, from the extreme sample offsets of every edge.
+    //kInside if all of them are inside the triangle, kOutside if none can be
+    BlockClass ClassifyPixel(const EdgeValues& e) const {
+        bool inside = true;
+        for (int k = 0; k < 3; ++k) {
+            if (e[k] + sample_max[k] < 0) return BlockClass::kOutside;
+            if (e[k] + sample_min[k] < 0) inside = false;
+        }
+        return inside ? BlockClass::kInside : BlockClass::kPartial;
+    }
+
+    //edge values at the center of pixel (x, y)
+    EdgeValues EdgeEquation(int x, int y) const {
+        int64_t sx = (int64_t)x * kSubPixelStep + kSubPixelHalf;
+        int64_t sy = (int64_t)y * kSubPixelStep + kSubPixelHalf;
+        return EdgeValues(
+            edge_a[0] * sx + edge_b[0] * sy + edge_c[0],
+            edge_a[1] * sx + edge_b[1] * sy + edge_c[1],
+            edge_a[2] * sx + edge_b[2] * sy + edge_c[2]
+        );
     }
 
-    bool Coverage(const Vec2f& pos, const Vec2i& pixel, int sub_sample, float& depth) const {
-        Vec3f w;
-        if (!Inside(pos, w)) {
+    static bool DepthTest(DepthFunc func, float z, float depth) {
+        return func == DepthFunc::kEqual ? z == depth : z < depth;
+    }
+
+    //kEdgeTest = false only interpolates and tests the depth, for pixels known to be inside
+    template <bool kEdgeTest = true>
+    bool Coverage(const EdgeValues& pixel_edge, const Vec2i& pixel, int sub_sample, DepthFunc func, float& depth) const {
+        EdgeValues e = pixel_edge + sample_offset[sub_sample];
+        if (kEdgeTest && (e.x | e.y | e.z) < 0) {
             return false;
         }
 
-        //depth in NDC [-1,1]
-        float z_interpolated = v0.position.z * w[0] + v1.position.z * w[1] + v2.position.z * w[2];
-        if (z_interpolated >= render_texture_->GetDepth(pixel.x, pixel.y, sub_sample)) {
+        float z_interpolated = depth_plane.At(pixel.x, pixel.y, sample_pos[sub_sample]);
+        if (!DepthTest(func, z_interpolated, render_texture_->GetDepth(pixel.x, pixel.y, sub_sample))) {
             return false;
         }
 
@@ -89,6 +259,56 @@ struct ScreenTriangle : private Uncopyable {
         return true;
     }
 
+    //coverage and depth test of kBlockSlots slots starting at pixel (x, y), e are its edge values.
+    //depth points at the depth samples of that pixel, the interpolated depth of every slot goes to z.
+    //bit i of the result is set if slot i is inside the triangle and passes the depth test.
+    //kEdgeTest = false skips the edge test for blocks known to be fully covered.
+    template <bool kEdgeTest>
+    int CoverageBlock(const EdgeValues& e, int x, int y, const float* depth, DepthFunc func, float* z) const {
+        //the same arithmetic as DepthPlane::At
+        float dx = (float)(x - depth_plane.x0);
+        float dy = (float)(y - depth_plane.y0);
+#ifdef RENDERTOY_SSE2
+        int mask = 0;
+        for (int half = 0; half < kBlockSlots; half += 4) {
+            __m128i sign = _mm_setzero_si128();
+            for (int k = 0; k < 3; ++k) {
+                if (kEdgeTest) {
+                    int32_t base = (int32_t)math::Clamp(e[k], -kBlockClamp, kBlockClamp);
+                    __m128i ei = _mm_add_epi32(_mm_set1_epi32(base), _mm_load_si128((const __m128i*)&block_offset[k][half]));
+                    sign = _mm_or_si128(sign, ei);
+                }
+            }
+
+            __m128 sx = _mm_add_ps(_mm_set1_ps(dx), _mm_load_ps(&block_dx[half]));
+            __m128 sy = _mm_add_ps(_mm_set1_ps(dy), _mm_load_ps(&block_dy[half]));
+            __m128 zi = _mm_add_ps(_mm_set1_ps(depth_plane.z0), _mm_mul_ps(_mm_set1_ps(depth_plane.dzdx), sx));
+            zi = _mm_add_ps(zi, _mm_mul_ps(_mm_set1_ps(depth_plane.dzdy), sy));
+            _mm_storeu_ps(z + half, zi);
+
+            int inside = ~_mm_movemask_ps(_mm_castsi128_ps(sign)) & 0xF;
+            __m128 d = _mm_loadu_ps(depth + half);
+            int pass = _mm_movemask_ps(func == DepthFunc::kEqual ? _mm_cmpeq_ps(zi, d) : _mm_cmplt_ps(zi, d));
+            mask |= (inside & pass) << half;
+        }
+        return mask;
+#else
+        int mask = 0;
+        for (int i = 0; i < kBlockSlots; ++i) {
+            bool inside = true;
+            for (int k = 0; k < 3; ++k) {
+                int64_t ei = e[k] + block_offset[k][i];
+                inside = inside && (!kEdgeTest || ei >= 0);
+            }
+            z[i] = depth_plane.z0 + depth_plane.dzdx * (dx + block_dx[i]) + depth_plane.dzdy * (dy + block_dy[i]);
+            if (inside && DepthTest(func, z[i], depth[i])) {
+                mask |= 1 << i;
+            }
+        }
+        return mask;
+#endif
+    }
+
     VertexOut Lerp(float w0, float w1, float w2) const {
         VertexOut o;
         o.w_reciprocal = v0.w_reciprocal * w0 + v1.w_reciprocal * w1 + v2.w_reciprocal * w2;
@@ -103,31 +323,81 @@ struct ScreenTriangle : private Uncopyable {
         return o;
     }
 
-    VertexOut Rasterize(float x, float y) const {
-        float e0 = EdgeEquation(x, y, 1, false);
-        float e1 = EdgeEquation(x, y, 2, false);
-        float e2 = EdgeEquation(x, y, 0, false);
-
-        float alpha = e0 * area2_reciprocal;
-        float beta = e1 * area2_reciprocal;
-        float gamma = e2 * area2_reciprocal;
-
-        //depth in view space reciprocal (z)
-        float w_reciprocal = 1.0f / (alpha * v0.w_reciprocal + beta * v1.w_reciprocal + gamma * v2.w_reciprocal);
-        float w0 = alpha * v0.w_reciprocal * w_reciprocal;
-        float w1 = beta * v1.w_reciprocal * w_reciprocal;
-        float w2 = gamma * v2.w_reciprocal * w_reciprocal;
+    //interpolate the 2x2 quad with pixel (x, y) at the top left, lane i is pixel (x + (i & 1), y + (i >> 1)).
+    //the attributes step from lane to lane, and the lanes are linked to each other for screen space derivatives
+    void RasterizeQuad(int x, int y, VertexOut* quad) const {
+        float dx = (float)(x - min.x);
+        float dy = (float)(y - min.y);
+        float w[4];
+        float w_reciprocal = w_plane.At(dx, dy);
+#ifdef RENDERTOY_SSE2
+        __m128 lanes = _mm_add_ps(_mm_set1_ps(w_reciprocal), _mm_setr_ps(0.0f, w_plane.ddx, w_plane.ddy, w_plane.ddx + w_plane.ddy));
+        _mm_storeu_ps(w, _mm_div_ps(_mm_set1_ps(1.0f), lanes));
+#else
+        w[0] = 1.0f / w_reciprocal;
+        w[1] = 1.0f / (w_reciprocal + w_plane.ddx);
+        w[2] = 1.0f / (w_reciprocal + w_plane.ddy);
+        w[3] = 1.0f / (w_reciprocal + (w_plane.ddx + w_plane.ddy));
+#endif
+        InterpolateQuad(planes.w_reciprocal, dx, dy, w, quad, &VertexOut::w_reciprocal);
+        InterpolateQuad(planes.position, dx, dy, w, quad, &VertexOut::position);
+        if (Interpolates(Varyings::kWorldPosition)) InterpolateQuad(planes.world_position, dx, dy, w, quad, &VertexOut::world_position);
+        if (Interpolates(Varyings::kColor)) InterpolateQuad(planes.color, dx, dy, w, quad, &VertexOut::color);
+        if (Interpolates(Varyings::kNormal)) InterpolateQuad(planes.normal, dx, dy, w, quad, &VertexOut::normal);
+        if (Interpolates(Varyings::kTangent)) InterpolateQuad(planes.tangent, dx, dy, w, quad, &VertexOut::tangent);
+        if (Interpolates(Varyings::kTexcoord)) InterpolateQuad(planes.texcoord, dx, dy, w, quad, &VertexOut::texcoord);
+        if (Interpolates(Varyings::kShadowCoord)) InterpolateQuad(planes.shadow_coord, dx, dy, w, quad, &VertexOut::shadow_coord);
+        for (int i = 0; i < 4; ++i) {
+            quad[i].quad = quad;
+            quad[i].lane = i;
+        }
+    }
 
-        return Lerp(w0, w1, w2);
+    template <typename T>
+    static void InterpolateQuad(const AttributePlane<T>& plane, float dx, float dy, const float* w, VertexOut* quad, T VertexOut::* attr) {
+        T q = plane.At(dx, dy);
+        T qx = q + plane.ddx;
+        quad[0].*attr = q * w[0];
+        quad[1].*attr = qx * w[1];
+        quad[2].*attr = (q + plane.ddy) * w[2];
+        quad[3].*attr = (qx + plane.ddy) * w[3];
     }
 
     float area2_reciprocal;
-    Vec4f edge[3];
+    //edge function: a * x + b * y + c, x and y in sub pixel units
+    int64_t edge_a[3];
+    int64_t edge_b[3];
+    int64_t edge_c[3];
+    EdgeValues step_x; //one pixel to the right
+    EdgeValues step_y; //one pixel along y
+    EdgeValues sample_offset[RenderTexture::kMaxSampleSize];
+    EdgeValues sample_min; //smallest sample offset of every edge
+    EdgeValues sample_max; //largest sample offset of every edge
+    bool block_coverage; //false if the triangle is too large for the 32 bit block kernel
+    alignas(16) int32_t block_offset[3][kBlockSlots]; //edge offsets of each block slot from the first pixel center
+    alignas(16) float block_dx[kBlockSlots]; //position of each block slot relative to the first pixel center
+    alignas(16) float block_dy[kBlockSlots];
+    Vec2f sample_pos[RenderTexture::kMaxSampleSize]; //sample offsets from the pixel center
+    DepthPlane depth_plane;
+    AttributePlane<float> w_plane; //1/w
+    struct {
+        AttributePlane<float> w_reciprocal;
+        AttributePlane<Vec4f> position;
+        AttributePlane<Vec3f> world_position;
+        AttributePlane<Vec4f> color;
+        AttributePlane<Vec3f> normal;
+        AttributePlane<Vec3f> tangent;
+        AttributePlane<Vec2f> texcoord;
+        AttributePlane<Vec3f> shadow_coord;
+    } planes; //varyings multiplied by 1/w
     Vec2i min;
     Vec2i max;
+    float min_z; //nearest depth of the triangle, for the hierarchical z test
     const VertexOut& v0;
     const VertexOut& v1;
     const VertexOut& v2;
+    Varyings varyings;
+    uint32_t id = 0; //visibility buffer id written instead of shading, 0 to shade
     RenderTexture* render_texture_;
 };
 
@@ -6,6 +6,9 @@
 
 namespace rendertoy {
 
+using math::Floatx4;
+using math::Vec3x4;
+
 VertexOut BlinnPhongShader::Vert(const Vertex& v) const {
     VertexOut v2f;
     v2f.position = uniform_->mvp * v.position;
@@ -18,33 +21,88 @@ VertexOut BlinnPhongShader::Vert(const Vertex& v) const {
     return v2f;
 }
 
+void BlinnPhongShader::VertBatch(const Vertex* vertices, int count, VertexOut* out) const {
+    //same as Vert, but each matrix transforms the whole batch
+    for (int i = 0; i < count; ++i) {
+        VertexOut v2f;
+        v2f.color = vertices[i].color;
+        v2f.texcoord = vertices[i].texcoord;
+        SetShadowCoord(vertices[i], v2f);
+        out[i] = v2f;
+    }
+
+    const Matrix4x4& model = uniform_->model;
+    math::TransformPoints(uniform_->mvp, &vertices->position, sizeof(Vertex), &out->position, sizeof(VertexOut), count);
+    math::TransformPoints(model, &vertices->position, sizeof(Vertex), &out->world_position, sizeof(VertexOut), count);
+    math::TransformVectors(model, &vertices->normal, sizeof(Vertex), &out->normal, sizeof(VertexOut), count);
+    math::TransformVectors(model, &vertices->tangent, sizeof(Vertex), &out->tangent, sizeof(VertexOut), count);
+}
+
 Vec4f BlinnPhongShader::Frag(const VertexOut& v2f) const {
     const BlinnPhongMaterial* mat = static_cast<const BlinnPhongMaterial*>(uniform_->mat);
     Vec3f albedo = mat->main_tex->SampleRGB(v2f.texcoord);
-    
-    Vec3f normal;
-    if (mat->normal_tex) {
-        Matrix3x3 TBN = v2f.TBN();
-        Vec4f tangent_normal = (mat->normal_tex->Sample2D(v2f.texcoord) * 2.0f - 1.0f);
-        normal = TBN * Vec3f(tangent_normal.x, tangent_normal.y, tangent_normal.z);
-    } else {
-        normal = v2f.normal.Normalize();
-    }
+    Vec3f normal = CalcNormal(mat, v2f);
 
     Vec3f color = mat->ambient_color * mat->ka; //ambient
     Vec3f view_dir = (uniform_->camera_pos - v2f.world_position).Normalize();
 
     for (auto& light : uniform_->lights) {
-        color += CalcLight(light, view_dir, mat->gloss, v2f, normal, albedo);
+        color += CalcLight(light, light.color * light.intensity, -light.direction, view_dir, mat->gloss, v2f, normal, albedo);
     }
 
     return color;
 }
 
-Vec3f BlinnPhongShader::CalcLight(const Light& light, const Vec3f& view_dir, float gloss, const VertexOut& v2f, const Vec3f& normal, const Vec3f& albedo) const {
-    Vec3f light_color = light.color * light.intensity;
-    Vec3f light_dir = -light.direction;
+void BlinnPhongShader::FragBatch(const FragmentBatch& batch, Vec4f* out) const {
+    //textures are sampled one fragment at a time, the light loop shades four fragments per packet
+    const BlinnPhongMaterial* mat = static_cast<const BlinnPhongMaterial*>(uniform_->mat);
+    const Vec3x4 camera_pos(uniform_->camera_pos);
+    const Vec3x4 ambient(mat->ambient_color * mat->ka);
+    const float gloss = mat->gloss;
+
+    for (int first = 0; first < batch.size; first += Floatx4::kLanes) {
+        FragmentPacket frag;
+        frag.fragments = batch.fragments + first;
+        frag.count = math::Min(Floatx4::kLanes, batch.size - first);
+        frag.active = Floatx4::FirstLanes(frag.count);
+
+        Vec3f world_position[Floatx4::kLanes], normal[Floatx4::kLanes], albedo[Floatx4::kLanes];
+        for (int i = 0; i < frag.count; ++i) {
+            const VertexOut& v2f = *frag.fragments[i];
+            world_position[i] = v2f.world_position;
+            albedo[i] = mat->main_tex->SampleRGB(v2f.texcoord);
+            normal[i] = CalcNormal(mat, v2f);
+        }
+        frag.world_position = Vec3x4::Gather(world_position, frag.count);
+        frag.normal = Vec3x4::Gather(normal, frag.count);
+        frag.albedo = Vec3x4::Gather(albedo, frag.count);
+
+        Vec3x4 view_dir = (camera_pos - frag.world_position).Normalize();
+        Vec3x4 color = ambient;
+        for (auto& light : uniform_->lights) {
+            color += CalcLight(light, view_dir, gloss, frag);
+        }
 
+        Vec3f colors[Floatx4::kLanes];
+        color.Scatter(colors, frag.count);
+        for (int i = 0; i < frag.count; ++i) {
+            out[first + i] = colors[i];
+        }
+    }
+}
+
+Vec3f BlinnPhongShader::CalcNormal(const BlinnPhongMaterial* mat, const VertexOut& v2f) const {
+    if (mat->normal_tex) {
+        Matrix3x3 TBN = v2f.TBN();
+        Vec4f tangent_normal = (mat->normal_tex->Sample2D(v2f.texcoord) * 2.0f - 1.0f);
+        return TBN * Vec3f(tangent_normal.x, tangent_normal.y, tangent_normal.z);
+    }
+    return v2f.normal.Normalize();
+}
+
+Vec3f BlinnPhongShader::CalcLight(const Light& light, Vec3f light_color, Vec3f light_dir, const Vec3f& view_dir,
+    float gloss, const VertexOut& v2f, const Vec3f& normal, const Vec3f& albedo) const
+{
     if (light.type == LightType::kPoint) {
         float r2 = (light.position - v2f.world_position).MagnitudeSq();
         light_color /= r2; // light attenuation
@@ -65,4 +123,43 @@ Vec3f BlinnPhongShader::CalcLight(const Light& light, const Vec3f& view_dir, flo
     return color * shadow;
 }
 
+Vec3x4 BlinnPhongShader::CalcLight(const Light& light, const Vec3x4& view_dir, float gloss, const FragmentPacket& frag) const {
+    Vec3x4 light_color(light.color * light.intensity);
+    Vec3x4 light_dir(-light.direction);
+
+    if (light.type == LightType::kPoint) {
+        Vec3x4 to_light = Vec3x4(light.position) - frag.world_position;
+        light_color = light_color / to_light.MagnitudeSq(); // light attenuation
+        light_dir = to_light.Normalize();
+    }
+
+    //unlit fragments get neither diffuse nor specular light
+    Floatx4 ndotl = Floatx4::Saturate(frag.normal.Dot(light_dir));
+    Floatx4 lit = (ndotl > 0.0f) & frag.active;
+    int lit_lanes = lit.MoveMask();
+    if (lit_lanes == 0) return Vec3x4(Vec3f::zero);
+
+    Vec3x4 h = (light_dir + view_dir).Normalize();
+    float ndoth[Floatx4::kLanes];
+    Floatx4::Saturate(frag.normal.Dot(h)).Store(ndoth);
+
+    //no packet pow, the specular term and the shadow map lookup are scalar per lit lane
+    float specular[Floatx4::kLanes] = {};
+    float shadow[Floatx4::kLanes] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    float ndotl_lanes[Floatx4::kLanes];
+    ndotl.Store(ndotl_lanes);
+    bool shadowed = &light == uniform_->shadow_light_;
+    for (int i = 0; i < frag.count; ++i) {
+        if ((lit_lanes & (1 << i)) == 0) continue;
+
+        specular[i] = std::pow(ndoth[i], gloss);
+        if (shadowed) {
+            shadow[i] = CalcShadow(light, *frag.fragments[i], ndotl_lanes[i]);
+        }
+    }
+
+    Vec3x4 color = light_color * frag.albedo * (ndotl + Floatx4::Load(specular)); //diffuse + specular
+    return Vec3x4::Select(lit, color * Floatx4::Load(shadow), Vec3x4(Vec3f::zero));
+}
+
 }
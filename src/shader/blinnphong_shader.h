@@ -3,22 +3,43 @@
 #include "shader.h"
 #include "common/singleton.h"
 #include "math/vec3.h"
+#include "math/packet.h"
 #include "light.h"
 
 namespace rendertoy {
 
+class BlinnPhongMaterial;
+
 //surfaceColor = emissive + ambient + diffuse + specular
 class BlinnPhongShader : public Shader, public Singleton<BlinnPhongShader> {
 public:
     VertexOut Vert(const Vertex& v) const override;
+    void VertBatch(const Vertex* vertices, int count, VertexOut* out) const override;
     Vec4f Frag(const VertexOut& v2f) const override;
+    void FragBatch(const FragmentBatch& batch, Vec4f* out) const override;
 
 private:
-    Vec3f CalcLight(const Light& light, const Vec3f& view_dir, 
+    //up to four fragments, one per lane
+    struct FragmentPacket {
+        math::Vec3x4 world_position;
+        math::Vec3x4 normal;
+        math::Vec3x4 albedo;
+        math::Floatx4 active; //lane mask of the fragments in the packet
+        const VertexOut* const* fragments; //for the shadow map lookups
+        int count;
+    };
+
+    Vec3f CalcNormal(const BlinnPhongMaterial* mat, const VertexOut& v2f) const;
+    //light_color and light_dir are those of a directional light, point lights replace them per fragment
+    Vec3f CalcLight(const Light& light, Vec3f light_color, Vec3f light_dir, const Vec3f& view_dir,
         float gloss, const VertexOut& v2f, const Vec3f& normal, const Vec3f& albedo) const;
+    //CalcLight for four fragments at a time
+    math::Vec3x4 CalcLight(const Light& light, const math::Vec3x4& view_dir, float gloss, const FragmentPacket& frag) const;
 
 protected:
-    BlinnPhongShader() : Shader("BlinnPhong") {}
+    BlinnPhongShader() : Shader("BlinnPhong") {
+        varyings_ = Varyings::kWorldPosition | Varyings::kNormal | Varyings::kTangent | Varyings::kTexcoord | Varyings::kShadowCoord;
+    }
 };
 
 }
@@ -11,7 +11,9 @@ public:
     Vec4f Frag(const VertexOut& v2f) const override;
     
 protected:
-    NormalShader() : Shader("Normal") {}
+    NormalShader() : Shader("Normal") {
+        varyings_ = Varyings::kNormal;
+    }
 };
 
 }
@@ -76,6 +76,37 @@ inline float GeometrySmith(float NoL, float NoV, float roughness) {
     return ggx1 * ggx2;
 }
 
+//packet versions of the helpers above, one fragment per lane
+using math::Floatx4;
+using math::Vec3x4;
+
+inline Floatx4 Pow5(const Floatx4& x) {
+    Floatx4 x2 = x * x;
+    return x2 * x2 * x;
+}
+
+inline Floatx4 D_GGX(const Floatx4& NoH, const Floatx4& roughness) {
+    Floatx4 alpha = roughness * roughness;
+    Floatx4 a2 = alpha * alpha;
+    Floatx4 f = (NoH * NoH) * (a2 - 1.0f) + 1.0f;
+    return a2 / (math::kPI * f * f);
+}
+
+inline Vec3x4 F_Schlick(const Vec3x4& f0, const Floatx4& VoH) {
+    Floatx4 f = Pow5(1.0f - VoH);
+    return f0 + (1.0f - f0) * f;
+}
+
+inline Floatx4 GeometrySchlickGGX(const Floatx4& NoV, const Floatx4& k) {
+    return NoV / (NoV * (1.0f - k) + k);
+}
+
+inline Floatx4 GeometrySmith(const Floatx4& NoL, const Floatx4& NoV, const Floatx4& roughness) {
+    Floatx4 r = roughness + 1.0f;
+    Floatx4 k = r * r * (1.0f / 8.0f);
+    return GeometrySchlickGGX(NoV, k) * GeometrySchlickGGX(NoL, k);
+}
+
 inline Vec3f PrefilteredDFG(float NoV, float roughness) {
     // 基于Lazarov的Karis逼近
     constexpr Vec4f c0 = Vec4f(-1.0, -0.0275, -0.572,  0.022);
@@ -85,59 +116,57 @@ inline Vec3f PrefilteredDFG(float NoV, float roughness) {
     return Vec3f(-1.04f * a004 + r.z, 1.04f * a004 + r.w, 0.0f);
 }
 
-Vec3f PbrShader::CalcLight(const Light& light, const VertexOut& v2f, const Vec3f& view_dir, const Vec3f& normal, const Vec3f& albedo,
-        const Vec3f& f0, float roughness, float metallic) const {
-    Vec3f light_color = light.color * light.intensity;
-    Vec3f light_dir = -light.direction;
+Vec3x4 PbrShader::CalcLight(const Light& light, const SurfacePacket& surface, const Vec3x4& view_dir, const Vec3x4& f0) const {
+    Vec3x4 light_color(light.color * light.intensity);
+    Vec3x4 light_dir(-light.direction);
 
     if (light.type == LightType::kPoint) {
-        float r2 = (light.position - v2f.world_position).MagnitudeSq();
-        light_color /= r2; // light attenuation
-        light_dir = (light.position - v2f.world_position).Normalize();
+        Vec3x4 to_light = Vec3x4(light.position) - surface.world_position;
+        light_color = light_color / to_light.MagnitudeSq(); // light attenuation
+        light_dir = to_light.Normalize();
     }
 
-    float NoL = math::Clamp(normal.Dot(light_dir), 0.0f, 1.0f);
-    if (NoL == 0.0f) return Vec3f::zero;
-
-    Vec3f h = (light_dir + view_dir).Normalize();
-    float NoH = math::Clamp(normal.Dot(h), 0.0f, 1.0f);
-    float NoV = math::Clamp(normal.Dot(view_dir), 0.0f, 1.0f);
-    float VoH = math::Clamp(view_dir.Dot(h), 0.0f, 1.0f);
-
-    Vec3f diffuse = albedo * Fd_Lambert(); //diffuse
-    //Vec3f diffuse = albedo * Fd_Burley(NoV, NoL, math::Clamp(light_dir.Dot(h), 0.0f, 1.0f), roughness); //diffuse
-
-    float D = D_GGX(NoH, roughness);
-    Vec3f F = F_Schlick(f0, VoH);
-    float G = GeometrySmith(NoL, NoV, roughness);
-    //float G = V_SmithGGXCorrelated(NoV, NoL, roughness);
-
-    float denominator = 4.0 * NoV * NoL + 0.001f;
-    Vec3f specular = (F * D * G) / denominator;
-    
-    // ks is equal to Fresnel
-    Vec3f ks = F;
-    // for energy conservation, the diffuse and specular light can't
-    // be above 1.0 (unless the surface emits light); to preserve this
-    // relationship the diffuse component (kd) should equal 1.0 - ks.
-    Vec3f kd = 1.0f - ks;
-    // multiply kd by the inverse metalness such that only non-metals 
-    // have diffuse lighting, or a linear blend if partly metal (pure metals
-    // have no diffuse light).
-    kd *= (1.0 - metallic);
-
-    // note that we already multiplied the BRDF by the Fresnel (ks) so we won't multiply by ks again
-    Vec3f color = (kd * diffuse + specular) * light_color * NoL;
+    Floatx4 NoL = Floatx4::Saturate(surface.normal.Dot(light_dir));
+    Floatx4 lit = (NoL > 0.0f) & surface.active;
+    int lit_lanes = lit.MoveMask();
+    if (lit_lanes == 0) return Vec3x4(Vec3f::zero);
+
+    Vec3x4 h = (light_dir + view_dir).Normalize();
+    Floatx4 NoH = Floatx4::Saturate(surface.normal.Dot(h));
+    Floatx4 NoV = Floatx4::Saturate(surface.normal.Dot(view_dir));
+    Floatx4 VoH = Floatx4::Saturate(view_dir.Dot(h));
+
+    Vec3x4 diffuse = surface.albedo * Floatx4(Fd_Lambert());
+
+    Floatx4 D = D_GGX(NoH, surface.roughness);
+    Vec3x4 F = F_Schlick(f0, VoH);
+    Floatx4 G = GeometrySmith(NoL, NoV, surface.roughness);
+
+    Floatx4 denominator = 4.0f * NoV * NoL + 0.001f;
+    Vec3x4 specular = F * (D * G / denominator);
+
+    Vec3x4 kd = (1.0f - F) * (1.0f - surface.metallic);
+    Vec3x4 color = (kd * diffuse + specular) * light_color * NoL;
+
+    //the shadow map is sampled per fragment, and only for the lit ones
+    if (&light == uniform_->shadow_light_) {
+        float shadow[Floatx4::kLanes] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        float ndotl[Floatx4::kLanes];
+        NoL.Store(ndotl);
+        for (int i = 0; i < surface.count; ++i) {
+            if ((lit_lanes & (1 << i)) != 0) {
+                shadow[i] = CalcShadow(light, surface.surfaces[i].shadow_coord, ndotl[i]);
+            }
+        }
+        color = color * Floatx4::Load(shadow);
+    }
 
-    float shadow = CalcShadow(light, v2f, NoL);
-    return color * shadow;
+    return Vec3x4::Select(lit, color, Vec3x4(Vec3f::zero));
 }
 
-Vec3f PbrShader::EvaluateIBL(const Vec3f& view_dir, const Vec3f& normal, const Vec3f& f0, 
+Vec3f PbrShader::EvaluateIBL(const PbrMaterial* mat, const Vec3f& view_dir, const Vec3f& normal, const Vec3f& f0, 
     const Vec3f& albedo, float metallic, float roughness, float ao) const
 {
-    const PbrMaterial* mat = static_cast<const PbrMaterial*>(uniform_->mat);
-
     Vec3f irradiance(0.0f);
     if (mat->irradiance_tex) {
         irradiance = mat->irradiance_tex->SampleRGB(normal);
@@ -177,50 +206,127 @@ VertexOut PbrShader::Vert(const Vertex& v) const {
     return v2f;
 }
 
+void PbrShader::VertBatch(const Vertex* vertices, int count, VertexOut* out) const {
+    //same as Vert, but each matrix transforms the whole batch
+    for (int i = 0; i < count; ++i) {
+        VertexOut v2f;
+        v2f.color = vertices[i].color;
+        v2f.texcoord = vertices[i].texcoord;
+        SetShadowCoord(vertices[i], v2f);
+        out[i] = v2f;
+    }
+
+    const Matrix4x4& model = uniform_->model;
+    math::TransformPoints(uniform_->mvp, &vertices->position, sizeof(Vertex), &out->position, sizeof(VertexOut), count);
+    math::TransformPoints(model, &vertices->position, sizeof(Vertex), &out->world_position, sizeof(VertexOut), count);
+    math::TransformVectors(model, &vertices->normal, sizeof(Vertex), &out->normal, sizeof(VertexOut), count);
+    math::TransformVectors(model, &vertices->tangent, sizeof(Vertex), &out->tangent, sizeof(VertexOut), count);
+}
+
 Vec4f PbrShader::Frag(const VertexOut& v2f) const {
+    SurfaceData surface;
+    Surface(v2f, surface);
+    return Lighting(surface, uniform_->mat);
+}
+
+void PbrShader::FragBatch(const FragmentBatch& batch, Vec4f* out) const {
+    //surfaces sample textures one fragment at a time, the light loop shades four fragments per packet
     const PbrMaterial* mat = static_cast<const PbrMaterial*>(uniform_->mat);
-    Vec3f albedo = mat->albedo_tex->SampleRGB(v2f.texcoord);
+    SurfaceData surfaces[FragmentBatch::kMaxSize];
+    for (int i = 0; i < batch.size; ++i) {
+        Surface(mat, *batch.fragments[i], surfaces[i]);
+    }
+    LightingBatch(surfaces, batch.size, mat, out);
+}
+
+void PbrShader::LightingBatch(const SurfaceData* surfaces, int count, const Material* material, Vec4f* out) const {
+    //image based lighting samples textures one surface at a time, the light loop shades four surfaces per packet
+    const PbrMaterial* mat = static_cast<const PbrMaterial*>(material);
+    const Vec3x4 camera_pos(uniform_->camera_pos);
+    const Vec3x4 mat_f0(mat->f0);
+
+    for (int first = 0; first < count; first += Floatx4::kLanes) {
+        SurfacePacket packet;
+        packet.surfaces = surfaces + first;
+        packet.count = math::Min(Floatx4::kLanes, count - first);
+        packet.active = Floatx4::FirstLanes(packet.count);
+
+        Vec3f albedo[Floatx4::kLanes], normal[Floatx4::kLanes], world_position[Floatx4::kLanes], emission[Floatx4::kLanes];
+        float metallic[Floatx4::kLanes] = {}, roughness[Floatx4::kLanes] = {};
+        for (int i = 0; i < packet.count; ++i) {
+            const SurfaceData& surface = packet.surfaces[i];
+            albedo[i] = surface.albedo;
+            normal[i] = surface.normal;
+            world_position[i] = surface.world_position;
+            emission[i] = surface.emission;
+            metallic[i] = surface.metallic;
+            roughness[i] = surface.roughness;
+        }
+        packet.albedo = Vec3x4::Gather(albedo, packet.count);
+        packet.normal = Vec3x4::Gather(normal, packet.count);
+        packet.world_position = Vec3x4::Gather(world_position, packet.count);
+        packet.metallic = Floatx4::Load(metallic);
+        packet.roughness = Floatx4::Load(roughness);
+
+        Vec3x4 view_dir = (camera_pos - packet.world_position).Normalize();
+        Vec3x4 f0 = Vec3x4::Lerp(mat_f0, packet.albedo, packet.metallic);
+        Vec3x4 color = Vec3x4::Gather(emission, packet.count);
+        for (auto& light : uniform_->lights) {
+            color += CalcLight(light, packet, view_dir, f0);
+        }
+
+        Vec3f colors[Floatx4::kLanes], view_dirs[Floatx4::kLanes], f0s[Floatx4::kLanes];
+        color.Scatter(colors, packet.count);
+        view_dir.Scatter(view_dirs, packet.count);
+        f0.Scatter(f0s, packet.count);
+        for (int i = 0; i < packet.count; ++i) {
+            const SurfaceData& surface = packet.surfaces[i];
+            colors[i] += EvaluateIBL(mat, view_dirs[i], surface.normal, f0s[i], surface.albedo, surface.metallic, surface.roughness, surface.ao);
+            out[first + i] = colors[i];
+        }
+    }
+}
+
+void PbrShader::Surface(const VertexOut& v2f, SurfaceData& surface) const {
+    Surface(static_cast<const PbrMaterial*>(uniform_->mat), v2f, surface);
+}
+
+void PbrShader::Surface(const PbrMaterial* mat, const VertexOut& v2f, SurfaceData& surface) const {
+    surface.albedo = mat->albedo_tex->SampleRGB(v2f.texcoord);
     
-    Vec3f normal;
     if (mat->normal_tex) {
         Matrix3x3 TBN = v2f.TBN();
         Vec4f tangent_normal = (mat->normal_tex->Sample2D(v2f.texcoord) * 2.0f - 1.0f);
-        normal = TBN * Vec3f(tangent_normal.x, tangent_normal.y, tangent_normal.z);
+        surface.normal = TBN * Vec3f(tangent_normal.x, tangent_normal.y, tangent_normal.z);
     } else {
-        normal = v2f.normal.Normalize();
+        surface.normal = v2f.normal.Normalize();
     }
 
-    float metallic = mat->metallic;
-    float roughness = mat->roughness;
+    surface.metallic = mat->metallic;
+    surface.roughness = mat->roughness;
     if (mat->metalroughness_tex) {
         Vec4f mr = mat->metalroughness_tex->Sample2D(v2f.texcoord);
-        metallic = mr.b;
-        roughness = mr.g;
+        surface.metallic = mr.b;
+        surface.roughness = mr.g;
     }
 
-    float ao = 1.0f;
+    surface.ao = 1.0f;
     if (mat->ao_tex) {
-        ao = mat->ao_tex->Sample2D(v2f.texcoord).r;
+        surface.ao = mat->ao_tex->Sample2D(v2f.texcoord).r;
     }
     
-    Vec3f f0 = Vec3f::Lerp(mat->f0, albedo, metallic);    
-    Vec3f color(0.0f);
+    surface.emission = Vec3f(0.0f);
     if (mat->emission_tex) {
-        color += mat->emission_tex->SampleRGB(v2f.texcoord);
+        surface.emission = mat->emission_tex->SampleRGB(v2f.texcoord);
     }
 
-    Vec3f view_dir = (uniform_->camera_pos - v2f.world_position).Normalize();
-    
-    for (auto& light : uniform_->lights) {
-        color += CalcLight(light, v2f, view_dir, normal, albedo, f0, roughness, metallic);
-    }
-    
-    // Vec3f ambient = mat->ambient_color * albedo * ao;
-    // color += ambient;
+    surface.world_position = v2f.world_position;
+    surface.shadow_coord = v2f.shadow_coord;
+}
 
-     Vec3f ambient = EvaluateIBL(view_dir, normal, f0, albedo, metallic, roughness, ao);
-     color += ambient;
-    
+Vec4f PbrShader::Lighting(const SurfaceData& surface, const Material* material) const {
+    Vec4f color;
+    LightingBatch(&surface, 1, material, &color);
     return color;
 }
 
@@ -2,22 +2,47 @@
 
 #include "shader.h"
 #include "common/singleton.h"
+#include "math/packet.h"
 
 namespace rendertoy {
 
+class PbrMaterial;
+
 class PbrShader : public Shader, public Singleton<PbrShader> {
 public:
     VertexOut Vert(const Vertex& v) const override;
+    void VertBatch(const Vertex* vertices, int count, VertexOut* out) const override;
     Vec4f Frag(const VertexOut& v2f) const override;
+    void FragBatch(const FragmentBatch& batch, Vec4f* out) const override;
+
+    void Surface(const VertexOut& v2f, SurfaceData& surface) const override;
+    Vec4f Lighting(const SurfaceData& surface, const Material* mat) const override;
+    void LightingBatch(const SurfaceData* surfaces, int count, const Material* mat, Vec4f* out) const override;
 private:
-    Vec3f CalcLight(const Light& light, const VertexOut& v2f, const Vec3f& view_dir, const Vec3f& normal, const Vec3f& albedo,
-        const Vec3f& f0, float roughness, float metallic) const;
+    //the surfaces of up to four fragments, one per lane
+    struct SurfacePacket {
+        math::Vec3x4 albedo;
+        math::Vec3x4 normal;
+        math::Vec3x4 world_position;
+        math::Floatx4 metallic;
+        math::Floatx4 roughness;
+        math::Floatx4 active; //lane mask of the fragments in the packet
+        const SurfaceData* surfaces; //the scalar surfaces, for the shadow map lookups
+        int count;
+    };
+
+    void Surface(const PbrMaterial* mat, const VertexOut& v2f, SurfaceData& surface) const;
+    //lights four surfaces at a time, forward and deferred shading both go through it
+    math::Vec3x4 CalcLight(const Light& light, const SurfacePacket& surface, const math::Vec3x4& view_dir, const math::Vec3x4& f0) const;
 
-    Vec3f EvaluateIBL(const Vec3f& view_dir, const Vec3f& normal, const Vec3f& f0,
+    Vec3f EvaluateIBL(const PbrMaterial* mat, const Vec3f& view_dir, const Vec3f& normal, const Vec3f& f0,
         const Vec3f& albedo, float metallic, float roughness, float ao) const;
 
 protected:
-    PbrShader() : Shader("PBR") {}
+    PbrShader() : Shader("PBR") {
+        deferred_ = true;
+        varyings_ = Varyings::kWorldPosition | Varyings::kNormal | Varyings::kTangent | Varyings::kTexcoord | Varyings::kShadowCoord;
+    }
 };
 
 }
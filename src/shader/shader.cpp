@@ -12,13 +12,27 @@ void Shader::SetShadowCoord(const Vertex& v, VertexOut& v2f) const {
     }
 }
 
+Vec3f Shader::ShadowCoord(const Vec3f& world_position) const {
+    if (!uniform_->shadow_light_) return Vec3f::zero;
+
+    Vec4f light_pos = uniform_->shadow_light_->vp_matrix * Vec4f(world_position, 1.0f);
+    light_pos /= light_pos.w;
+    light_pos = light_pos * 0.5f + 0.5f;
+    return { light_pos.x, light_pos.y, light_pos.z };
+}
+
 float Shader::CalcShadow(const Light& light, const VertexOut& v2f, float ndotl) const {
+    return CalcShadow(light, v2f.shadow_coord, ndotl);
+}
+
+float Shader::CalcShadow(const Light& light, const Vec3f& shadow_coord, float ndotl) const {
     if (&light == uniform_->shadow_light_) {
-        auto& shadow_coord = v2f.shadow_coord;
         if (shadow_coord.z < 0.0f || shadow_coord.z > 1.0f) {
             return 1.0f;
         }
 
+        //sampled as a plain texture, the shadow map has to keep the row-major layout
+        assert(!uniform_->shadow_light_->shadow_map->tiled());
         auto& shadow_map = uniform_->shadow_light_->shadow_map->depth_buffer();
 
         static constexpr int pcf_range = 2;
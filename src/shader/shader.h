@@ -4,6 +4,7 @@
 #include "vertex.h"
 #include "uniform.h"
 #include "types.h"
+#include "gbuffer.h"
 
 namespace rendertoy {
 
@@ -14,7 +15,38 @@ public:
     const std::string& name() const { return name_; }
     
     virtual VertexOut Vert(const Vertex& v) const = 0;
+    //shades count vertices into out, the default calls Vert for each of them
+    virtual void VertBatch(const Vertex* vertices, int count, VertexOut* out) const {
+        for (int i = 0; i < count; ++i) {
+            out[i] = Vert(vertices[i]);
+        }
+    }
     virtual Vec4f Frag(const VertexOut& v2f) const = 0;
+    //shades batch.size fragments into out, the default calls Frag for each of them. overrides read
+    //the uniform and material once per batch instead of once per fragment
+    virtual void FragBatch(const FragmentBatch& batch, Vec4f* out) const {
+        for (int i = 0; i < batch.size; ++i) {
+            out[i] = Frag(*batch.fragments[i]);
+        }
+    }
+
+    //deferred shading, only used if deferred() is set: Surface fills the g-buffer in the geometry pass,
+    //Lighting shades a surface read back from it in the screen space pass
+    virtual void Surface(const VertexOut&, SurfaceData&) const {}
+    virtual Vec4f Lighting(const SurfaceData& surface, const Material*) const { return Vec4f(surface.albedo, 1.0f); }
+    //Lighting for count surfaces of one material, the default calls Lighting for each of them
+    virtual void LightingBatch(const SurfaceData* surfaces, int count, const Material* mat, Vec4f* out) const {
+        for (int i = 0; i < count; ++i) {
+            out[i] = Lighting(surfaces[i], mat);
+        }
+    }
+    bool deferred() const { return deferred_; }
+
+    //varyings Vert fills in and Frag uses, the rest are left default constructed
+    Varyings varyings() const { return varyings_; }
+
+    //shadow map coordinate of a world space position, see SetShadowCoord
+    Vec3f ShadowCoord(const Vec3f& world_position) const;
 
     void uniform(Uniform* u) { uniform_ = u; }
     const Uniform* uniform() const { return uniform_; }
@@ -22,20 +54,23 @@ public:
     CullMode cull() const { return cull_; }
     void cull(CullMode cull) { cull_ = cull; }
 
-    bool write_depth(bool write) { write_depth_ = write; }
+    void write_depth(bool write) { write_depth_ = write; }
     bool write_depth() const { return write_depth_; }
 
-    bool write_color(bool write) { write_color_ = write; }
+    void write_color(bool write) { write_color_ = write; }
     bool write_color() const { return write_color_; }
 
 protected:
-    Shader(const char* name) : write_depth_(true), write_color_(true), cull_(CullMode::kBack), name_(name), uniform_(nullptr) {}
+    Shader(const char* name) : write_depth_(true), write_color_(true), deferred_(false), varyings_(Varyings::kAll), cull_(CullMode::kBack), name_(name), uniform_(nullptr) {}
 
     void SetShadowCoord(const Vertex& v, VertexOut& v2f) const;
     float CalcShadow(const Light& light, const VertexOut& v2f, float ndotl) const;
+    float CalcShadow(const Light& light, const Vec3f& shadow_coord, float ndotl) const;
     
     bool write_depth_;
     bool write_color_;
+    bool deferred_;
+    Varyings varyings_;
     CullMode cull_;
     std::string name_;
     Uniform* uniform_;
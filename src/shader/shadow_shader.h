@@ -13,6 +13,7 @@ public:
 protected:
     ShadowShader() : Shader("Shadow") { 
         write_color_ = false;
+        varyings_ = Varyings::kNone;
     }
 };
 
@@ -21,4 +21,12 @@ Vec4f SkyboxShader::Frag(const VertexOut& v2f) const {
     return mat->skybox_tex->Sample3D(coord);
 }
 
+void SkyboxShader::FragBatch(const FragmentBatch& batch, Vec4f* out) const {
+    const SkyboxMaterial* mat = static_cast<const SkyboxMaterial*>(uniform_->mat);
+    const auto* skybox_tex = mat->skybox_tex;
+    for (int i = 0; i < batch.size; ++i) {
+        out[i] = skybox_tex->Sample3D(batch.fragments[i]->world_position.Normalize());
+    }
+}
+
 }
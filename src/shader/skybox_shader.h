@@ -9,11 +9,13 @@ class SkyboxShader : public Shader, public Singleton<SkyboxShader> {
 public:
     VertexOut Vert(const Vertex& v) const override;
     Vec4f Frag(const VertexOut& v2f) const override;
+    void FragBatch(const FragmentBatch& batch, Vec4f* out) const override;
     
 protected:
     SkyboxShader() : Shader("Skybox") {
         write_depth_ = false;
         cull_ = CullMode::kFront;
+        varyings_ = Varyings::kWorldPosition;
     }
 };
 
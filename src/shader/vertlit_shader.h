@@ -11,7 +11,9 @@ public:
     Vec4f Frag(const VertexOut& v2f) const override;
     
 protected:
-    VertLitShader() : Shader("VertLit") { }
+    VertLitShader() : Shader("VertLit") {
+        varyings_ = Varyings::kColor;
+    }
 };
 
 }
@@ -0,0 +1,127 @@
+#include <iostream>
+#include <cmath>
+#include <limits>
+#include "math/util.h"
+#include "model.h"
+#include "camera.h"
+#include "pipeline.h"
+
+using namespace rendertoy;
+
+//EQAA regression: fans of thin triangles meet inside pixels, so those pixels see more fragments than
+//they have colors. no sample a triangle covers may keep the clear color, and forward and visibility
+//shading have to agree up to the color change across a pixel
+
+constexpr int kSize = 64;
+constexpr int kFans = 4;
+constexpr int kFanTriangles = 16;
+//largest difference of a resolved channel between the shading modes, the vertex colors change by
+//about 0.01 per pixel
+constexpr float kTolerance = 0.01f;
+
+Vec3f fan_color(float x, float y) {
+    return Vec3f(0.6f + 0.3f * x, 0.5f + 0.3f * y, 0.3f);
+}
+
+Mesh create_fans() {
+    Mesh mesh;
+    for (int fy = 0; fy < kFans; ++fy) {
+        for (int fx = 0; fx < kFans; ++fx) {
+            //centers off the pixel grid, radius of a few pixels
+            float cx = -0.75f + 0.5f * fx + 0.013f * fy;
+            float cy = -0.75f + 0.5f * fy + 0.021f * fx;
+            float radius = 0.08f + 0.02f * ((fx + fy) % 3);
+
+            uint32_t center = (uint32_t)mesh.vertices().size();
+            mesh.AddVertex(Vec3f(cx, cy, 0.0f), fan_color(cx, cy));
+            for (int i = 0; i < kFanTriangles; ++i) {
+                float angle = 2.0f * math::kPI * i / kFanTriangles;
+                float x = cx + radius * std::cos(angle);
+                float y = cy + radius * std::sin(angle);
+                mesh.AddVertex(Vec3f(x, y, 0.0f), fan_color(x, y));
+            }
+            for (int i = 0; i < kFanTriangles; ++i) {
+                uint32_t next = center + 1 + (i + 1) % kFanTriangles;
+                mesh.AddTriangle(center, next, center + 1 + i);
+            }
+        }
+    }
+    return mesh;
+}
+
+void render(Pipeline& pipeline, RenderTexture& render_texture, ShadingMode mode) {
+    Camera camera(40, 0.1, 50, { 0, 0, -3 }, Vec3f::zero, Vec3f::up);
+    render_texture.Clear(Buffers::kColor | Buffers::kDepth);
+    pipeline.SetRenderTarget(&render_texture);
+    pipeline.SetShadingMode(mode);
+    pipeline.Render(camera, Primitive::kTriangle);
+}
+
+//every sample with a depth was covered by a triangle and has to hold a triangle color
+bool check_covered(const RenderTexture& render_texture, const Vec4f& clear, const char* name) {
+    int covered = 0;
+    int failed = 0;
+    for (int y = 0; y < render_texture.height(); ++y) {
+        for (int x = 0; x < render_texture.width(); ++x) {
+            for (int i = 0; i < render_texture.sample_size(); ++i) {
+                if (render_texture.GetDepth(x, y, i) == std::numeric_limits<float>::infinity()) continue;
+
+                ++covered;
+                if (render_texture.GetColor(x, y, i) == clear) {
+                    if (failed++ == 0) {
+                        std::cerr << name << ": covered sample " << i << " of pixel (" << x << ", " << y << ") has the clear color" << std::endl;
+                    }
+                }
+            }
+        }
+    }
+
+    if (covered == 0) {
+        std::cerr << name << ": no sample is covered" << std::endl;
+        return false;
+    }
+    if (failed > 0) {
+        std::cerr << name << ": " << failed << " of " << covered << " covered samples have the clear color" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool check_match(const RenderTexture& a, const RenderTexture& b) {
+    const Vec4f* ca = a.resolved_buffer().data().data();
+    const Vec4f* cb = b.resolved_buffer().data().data();
+    float max_diff = 0.0f;
+    for (int i = 0; i < a.width() * a.height(); ++i) {
+        for (int c = 0; c < 3; ++c) {
+            max_diff = math::Max(max_diff, std::abs(ca[i][c] - cb[i][c]));
+        }
+    }
+
+    if (max_diff > kTolerance) {
+        std::cerr << "forward and visibility differ by " << max_diff << ", more than " << kTolerance << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main() {
+    Pipeline pipeline;
+    Model model;
+    model.AddMesh(create_fans());
+    pipeline.AddModel(std::move(model));
+
+    RenderTexture forward(kSize, kSize, MSAALevel::kEQAA8x);
+    RenderTexture visibility(kSize, kSize, MSAALevel::kEQAA8x);
+
+    //the cleared color as stored, nothing is drawn yet
+    forward.Clear(Buffers::kColor);
+    Vec4f clear = forward.GetColor(0, 0, 0);
+
+    render(pipeline, forward, ShadingMode::kForward);
+    render(pipeline, visibility, ShadingMode::kVisibility);
+
+    bool ok = check_covered(forward, clear, "forward");
+    ok = check_covered(visibility, clear, "visibility") && ok;
+    ok = check_match(forward, visibility) && ok;
+    return ok ? 0 : 1;
+}
@@ -101,7 +101,7 @@ void Texture2D::ConvertToImage(Buffer<Col3U8>& image_buffer) const {
 
     for (int i = 0; i< texture_.height(); ++i) {
         for (int j = 0;j < texture_.width(); ++j) {
-            auto& col = texture_.Get(j, i);
+            auto col = texture_.Get(j, i);
             image_buffer.Set(j, texture_.height() - i - 1, Col3U8(col.r * 255.0f, col.g * 255.0f, col.b * 255.0f));
         }
     }
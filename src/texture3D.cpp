@@ -1,4 +1,4 @@
-#include "texture3d.h"
+#include "texture3D.h"
 #include <cmath>
 #include <cassert>
 #include "math/util.h"
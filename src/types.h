@@ -25,15 +25,54 @@ enum class CullMode : uint8_t {
     kFront,
 };
 
+enum class DepthFunc : uint8_t {
+    kLess, //pass if nearer than the stored depth
+    kEqual, //pass if equal to the stored depth, for shading after a depth pre-pass
+};
+
 enum class Primitive : uint8_t {
     kLine,
     kTriangle
 };
 
+enum class RasterBackend : uint8_t {
+    kImmediate, //rasterize every triangle as soon as it is submitted (reference path)
+    kTiled, //bin triangles into screen tiles and rasterize the tiles on a thread pool
+};
+
+//statistics gathered by Graphics, see Graphics::counter
+enum class RenderCounter : uint8_t {
+    kBlockAccepted, //8x8 blocks fully inside the triangle
+    kBlockRejected, //8x8 blocks fully outside the triangle
+    kBlockPartial, //8x8 blocks crossing an edge
+    kBlockOccluded, //8x8 blocks skipped by the hierarchical z test
+    kTileOccluded, //binned triangles skipped for a whole tile by the hierarchical z test
+    kFragmentShaded, //fragment shader invocations
+    kPixelLit, //surfaces shaded by the deferred lighting pass, up to two per pixel under MSAA
+    kVertexShaded, //vertex shader invocations
+    kTriangleRejected, //triangles entirely outside one clip plane
+    kTriangleCulled, //triangles dropped by the cull mode
+    kTriangleClipped, //triangles that went through the clipper instead of the guard band
+    kCount
+};
+
+enum class ShadingMode : uint8_t {
+    kForward, //shade fragments while rasterizing
+    kDeferred, //write surfaces to a g-buffer, light them in a screen space pass
+    kVisibility, //write triangle ids to the render texture, shade the visible ones in a screen space pass
+};
+
 enum class MSAALevel : uint8_t {
     kNone = 0,
     k2x = 1,
     k4x = 2,
+    kEQAA8x = 3, //8 coverage and depth samples sharing at most 2 colors per pixel
+};
+
+//how RenderTexture::Resolve turns the samples of a pixel into one color
+enum class ResolveFilter : uint8_t {
+    kBox, //average of the samples of the pixel
+    kTent, //samples up to one pixel away from the center, weighted by their distance to it
 };
 
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <vector>
+#include <stdint.h>
 #include "common/uncopyable.h"
 #include "math/vec2.h"
 #include "math/vec3.h"
@@ -55,6 +56,27 @@ struct Vertex {
     }
 };
 
+//varyings of VertexOut a shader writes and reads, position and w_reciprocal are always there.
+//clipping and interpolation skip the others
+enum class Varyings : uint8_t {
+    kNone = 0,
+    kWorldPosition = 1,
+    kColor = 2,
+    kNormal = 4,
+    kTangent = 8,
+    kTexcoord = 16,
+    kShadowCoord = 32,
+    kAll = 63
+};
+
+inline Varyings operator|(Varyings a, Varyings b) {
+    return Varyings((int)a | (int)b);
+}
+
+inline Varyings operator&(Varyings a, Varyings b) {
+    return Varyings((int)a & (int)b);
+}
+
 struct VertexOut {
     float w_reciprocal;
     Vec4f position; //SV_POSTION
@@ -64,6 +86,23 @@ struct VertexOut {
     mutable Vec3f tangent;
     Vec2f texcoord;
     Vec3f shadow_coord;
+
+    //set by the rasterizer: the 2x2 quad this fragment is shaded in and its lane,
+    //lane i is pixel (i & 1, i >> 1) of the quad
+    const VertexOut* quad = nullptr;
+    int lane = 0;
+
+    //screen space derivatives of an attribute, e.g. v2f.Ddx(&VertexOut::texcoord),
+    //zero outside of a quad
+    template <typename T>
+    T Ddx(T VertexOut::* attr) const {
+        return quad ? quad[lane | 1].*attr - quad[lane & 2].*attr : T();
+    }
+
+    template <typename T>
+    T Ddy(T VertexOut::* attr) const {
+        return quad ? quad[lane | 2].*attr - quad[lane & 1].*attr : T();
+    }
     
     bool InsideFrustum(float near, float far) const {
         if (position.w < near || position.w > far) return false;
@@ -85,13 +124,25 @@ struct VertexOut {
     }
 };
 
+//covered fragments of one triangle shaded by a single Shader::FragBatch call, every fragment still points
+//into its 2x2 quad for derivatives
+struct FragmentBatch {
+    //the pixels of one raster block: two rows of 8 without MSAA
+    static constexpr int kMaxSize = 16;
+
+    const VertexOut* fragments[kMaxSize];
+    int size = 0;
+};
+
 struct ClipPlane {
     math::Axis axis;
     float sign;
 
-    bool Inside(const Vec4f& pos) const {
+    //scale > 1 moves the plane outwards, e.g. for a guard band
+    bool Inside(const Vec4f& pos, float scale = 1.0f) const {
         float c = pos[static_cast<int>(axis)];
-        return sign > 0 ? c <= pos.w : c >= -pos.w;
+        float w = pos.w * scale;
+        return sign > 0 ? c <= w : c >= -w;
     }
 
     float Intersect(const Vec4f& p0, const Vec4f& p1) const {